@@ -0,0 +1,48 @@
+#include "./loopback.h"
+
+#include <benchmark/benchmark.h>
+#include <ewhttp/router.h>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+	using namespace ewhttp::build::underscore;
+
+	constexpr size_t file_count = 100;
+
+	// file0.txt .. file99.txt with a line of text, and one file of every size BM_FilesSend uses
+	const std::filesystem::path &sample_root() {
+		static const auto root = [] {
+			auto path = std::filesystem::temp_directory_path() / "ewhttp_bench_files";
+			std::filesystem::create_directories(path);
+			for (size_t i = 0; i < file_count; i++)
+				std::ofstream{path / ("file" + std::to_string(i) + ".txt")} << "Hello from file " << i << "!\n";
+			for (const size_t size : {1024, 64 * 1024, 1024 * 1024})
+				std::ofstream{path / ("size" + std::to_string(size) + ".bin"), std::ios::binary} << std::string(size, 'x');
+			return path;
+		}();
+		return root;
+	}
+
+	void BM_FilesFind(benchmark::State &state) {
+		const ewhttp::build::Files files{sample_root().string()};
+		std::array<std::string, file_count> names;
+		for (size_t i = 0; i < file_count; i++) names[i] = "file" + std::to_string(i) + ".txt";
+		size_t next = 0;
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(files.find(names[next]));
+			next = next + 1 == file_count ? 0 : next + 1;
+		}
+	}
+	BENCHMARK(BM_FilesFind);
+
+	// range(0) bytes, range(1): 1 to serve from memory, 0 to sendfile from disk
+	void BM_FilesSend(benchmark::State &state) {
+		const auto size = static_cast<size_t>(state.range(0));
+		const bool memory = state.range(1) == 1;
+		const auto router = ewhttp::create_router(_("files", _.files(sample_root().string(), {.max_memory_cached = memory ? size + 1 : 0, .compress = false})));
+		ewhttp::bench::pipelined_round_trips(state, router, "/files/size" + std::to_string(size) + ".bin");
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * ewhttp::bench::pipeline_depth * size));
+	}
+	BENCHMARK(BM_FilesSend)->ArgNames({"size", "memory"})->ArgsProduct({{1024, 64 * 1024, 1024 * 1024}, {0, 1}})->UseRealTime();
+} // namespace
@@ -0,0 +1,171 @@
+#include "./load.h"
+#include "./loopback.h"
+
+#include <algorithm>
+#include <charconv>
+#include <ewhttp/router.h>
+#include <iostream>
+#include <vector>
+
+namespace ewhttp::bench {
+	namespace {
+		using steady_clock = std::chrono::steady_clock;
+
+		// what one client thread saw
+		struct Results {
+			// nanoseconds from writing a batch until each of its responses was complete
+			std::vector<int64_t> latencies{};
+			size_t errors = 0;
+		};
+
+		int count_response(llhttp_t *parser) {
+			++*static_cast<size_t *>(parser->data);
+			return 0;
+		}
+
+		// one connection, writing batches and reading their responses until `end`
+		async drive(const asio::ip::tcp::endpoint endpoint, const LoadOptions &options, const std::string &batch, const steady_clock::time_point end, Results &results) {
+			auto executor = co_await asio::this_coro::executor;
+			asio::ip::tcp::socket socket{executor};
+			llhttp_settings_t settings;
+			llhttp_settings_init(&settings);
+			settings.on_message_complete = count_response;
+			llhttp_t parser;
+			size_t completed = 0;
+			std::vector<char> buffer(64 * 1024);
+			while (steady_clock::now() < end) {
+				asio::error_code ec;
+				if (!socket.is_open()) {
+					co_await socket.async_connect(endpoint, asio::redirect_error(asio::use_awaitable, ec));
+					if (ec) {
+						results.errors++;
+						socket.close(ec);
+						continue;
+					}
+					socket.set_option(asio::ip::tcp::no_delay(true));
+					llhttp_init(&parser, HTTP_RESPONSE, &settings);
+					parser.data = &completed;
+					completed = 0;
+				}
+				const auto sent = steady_clock::now();
+				co_await asio::async_write(socket, asio::buffer(batch), asio::redirect_error(asio::use_awaitable, ec));
+				while (!ec && completed < options.depth) {
+					const auto n = co_await socket.async_read_some(asio::buffer(buffer), asio::redirect_error(asio::use_awaitable, ec));
+					if (ec) break;
+					const auto before = completed;
+					if (llhttp_execute(&parser, buffer.data(), n) != HPE_OK) {
+						ec = asio::error::invalid_argument;
+						break;
+					}
+					const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(steady_clock::now() - sent).count();
+					for (size_t i = before; i < completed; i++) results.latencies.push_back(latency);
+				}
+				if (ec) results.errors++;
+				if (ec || !options.keep_alive) socket.close(ec);
+				else completed = 0;
+			}
+			asio::error_code ec;
+			socket.close(ec);
+		}
+
+		template<class T>
+		bool parse_number(const std::string_view arg, T &out) {
+			const auto result = std::from_chars(arg.data(), arg.data() + arg.size(), out);
+			if (result.ec != std::errc{}) {
+				std::cerr << "Invalid number '" << arg << "': " << std::make_error_code(result.ec).message() << std::endl;
+				return false;
+			}
+			return true;
+		}
+
+		double micros_at(const std::vector<int64_t> &sorted, const double percentile) {
+			if (sorted.empty()) return 0;
+			const auto index = std::min(sorted.size() - 1, static_cast<size_t>(percentile * static_cast<double>(sorted.size())));
+			return static_cast<double>(sorted[index]) / 1000.0;
+		}
+	} // namespace
+
+	int load(const std::span<const std::string_view> args) {
+		LoadOptions options;
+		for (auto it = args.begin(); it != args.end(); ++it) {
+			const auto needs_value = [&] {
+				if (it + 1 != args.end()) return true;
+				std::cerr << "No value specified after " << *it << std::endl;
+				return false;
+			};
+			if (*it == "-c" || *it == "--connections") {
+				if (!needs_value() || !parse_number(*++it, options.connections)) return 1;
+			} else if (*it == "-d" || *it == "--depth") {
+				if (!needs_value() || !parse_number(*++it, options.depth)) return 1;
+			} else if (*it == "-s" || *it == "--seconds") {
+				int64_t seconds;
+				if (!needs_value() || !parse_number(*++it, seconds)) return 1;
+				options.duration = std::chrono::seconds{seconds};
+			} else if (*it == "-t" || *it == "--threads") {
+				if (!needs_value() || !parse_number(*++it, options.server_threads)) return 1;
+			} else if (*it == "-T" || *it == "--client-threads") {
+				if (!needs_value() || !parse_number(*++it, options.client_threads)) return 1;
+			} else if (*it == "--path") {
+				if (!needs_value()) return 1;
+				options.path = *++it;
+			} else if (*it == "--close") {
+				options.keep_alive = false;
+			} else {
+				std::cout << "Usage: ewhttp_bench load [-c|--connections N] [-d|--depth PIPELINED] [-s|--seconds S] [-t|--threads SERVER_THREADS] [-T|--client-threads N] [--path PATH] [--close]\n"
+							 "Without `load`, runs the microbenchmarks (google benchmark flags apply)."
+						  << std::endl;
+				return *it == "--help" ? 0 : 1;
+			}
+		}
+		options.depth = std::max<size_t>(options.depth, 1);
+		options.client_threads = std::max(options.client_threads, 1u);
+
+		using namespace build::underscore;
+		const auto router = create_router(
+				_.fallback([](Req, Res response) -> async {
+					response.status = 404;
+					co_await response.send_body(std::string_view{"Not Found"});
+				}),
+				GET([](Req, Res response) -> async {
+					static const HeaderBlock headers{{"Content-Type", "text/plain"}, {"Server", "ewhttp"}};
+					response.add_headers(headers);
+					co_await response.send_body(std::string_view{"Hello, World!"});
+				}),
+				_("metrics", _.metrics()));
+		LoopbackServer server{router, options.server_threads, {.max_pipelined = std::max<size_t>(options.depth, 16)}};
+		const asio::ip::tcp::endpoint endpoint{asio::ip::address_v4::loopback(), server.port()};
+		const auto batch = pipeline(options.path, options.depth);
+
+		std::vector<Results> results(options.client_threads);
+		{
+			// the server may still be starting up
+			Client{server.port()}.close();
+			const auto start = steady_clock::now();
+			const auto end = start + options.duration;
+			std::vector<std::jthread> clients;
+			for (unsigned int t = 0; t < options.client_threads; t++)
+				clients.emplace_back([&, t] {
+					asio::io_context io_context{1};
+					for (size_t c = t; c < options.connections; c += options.client_threads)
+						asio::co_spawn(io_context, drive(endpoint, options, batch, end, results[t]), asio::detached);
+					io_context.run();
+				});
+		}
+
+		std::vector<int64_t> latencies;
+		size_t errors = 0;
+		for (auto &result : results) {
+			latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+			errors += result.errors;
+		}
+		std::ranges::sort(latencies);
+		const auto seconds = std::chrono::duration<double>(options.duration).count();
+		std::cout << options.connections << " connections, " << options.depth << " pipelined, " << (options.keep_alive ? "keep-alive" : "reconnecting")
+				  << ", " << options.server_threads << " server thread(s) on " << io_backend << ", " << options.client_threads << " client thread(s), " << seconds << "s of " << options.path << '\n'
+				  << "requests: " << latencies.size() << ", errors: " << errors << '\n'
+				  << "req/s: " << static_cast<double>(latencies.size()) / seconds << '\n'
+				  << "latency (us): p50 " << micros_at(latencies, 0.5) << ", p99 " << micros_at(latencies, 0.99) << ", p999 " << micros_at(latencies, 0.999)
+				  << ", max " << micros_at(latencies, 1) << std::endl;
+		return 0;
+	}
+} // namespace ewhttp::bench
@@ -0,0 +1,25 @@
+#pragma once
+#include <chrono>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace ewhttp::bench {
+	struct LoadOptions {
+		size_t connections = 64;
+		// requests written at once per connection before waiting for their responses
+		size_t depth = 1;
+		// false: every connection sends one batch, then reconnects
+		bool keep_alive = true;
+		std::chrono::seconds duration{5};
+		unsigned int server_threads = 1, client_threads = 1;
+		std::string path = "/";
+	};
+
+	/**
+	 * \brief Run an in-process server and hammer it over loopback, then print req/s and latency percentiles.
+	 * \param args Command line arguments after `load`.
+	 * \return Exit code.
+	 */
+	int load(std::span<const std::string_view> args);
+} // namespace ewhttp::bench
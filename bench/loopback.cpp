@@ -0,0 +1,90 @@
+#include "./loopback.h"
+
+#include <chrono>
+#include <stdexcept>
+
+namespace ewhttp::bench {
+	namespace {
+		// let the kernel pick a port, then hand it to the server. another process could take it in between, which is fine for a benchmark.
+		uint16_t free_port() {
+			asio::io_context io_context{1};
+			asio::ip::tcp::acceptor acceptor{io_context, {asio::ip::address_v4::loopback(), 0}};
+			return acceptor.local_endpoint().port();
+		}
+
+		int count_response(llhttp_t *parser) {
+			++static_cast<Client *>(parser->data)->completed;
+			return 0;
+		}
+	} // namespace
+
+	LoopbackServer::LoopbackServer(server_callback callback, const unsigned int threads, const ServerOptions &options)
+		: server{std::move(callback), options}, port_{free_port()},
+		  runner{[this, threads] { server.run(asio::ip::address_v4::loopback(), port_, threads); }} {}
+
+	LoopbackServer::~LoopbackServer() {
+		server.stop();
+		// runner joins once the last connection is closed
+	}
+
+	Client::Client(const uint16_t port) {
+		const asio::ip::tcp::endpoint endpoint{asio::ip::address_v4::loopback(), port};
+		for (int attempt = 0;; attempt++) {
+			asio::error_code ec;
+			socket.connect(endpoint, ec);
+			if (!ec) break;
+			socket.close();
+			if (attempt == 1000) throw std::system_error(ec, "connecting to the benchmark server");
+			std::this_thread::sleep_for(std::chrono::milliseconds{1});
+		}
+		socket.set_option(asio::ip::tcp::no_delay(true));
+		llhttp_settings_init(&settings);
+		settings.on_message_complete = count_response;
+		llhttp_init(&parser, HTTP_RESPONSE, &settings);
+		parser.data = this;
+	}
+
+	void Client::round_trip(const std::string_view requests, const size_t count) {
+		asio::write(socket, asio::buffer(requests.data(), requests.size()));
+		const size_t target = completed + count;
+		while (completed < target) {
+			const auto n = socket.read_some(asio::buffer(buffer));
+			reads++;
+			bytes_read += n;
+			if (const auto result = llhttp_execute(&parser, buffer.data(), n); result != HPE_OK)
+				throw std::runtime_error(std::string{"bad response: "} + llhttp_errno_name(result));
+		}
+	}
+
+	void Client::close() {
+		asio::error_code ec;
+		socket.shutdown(asio::socket_base::shutdown_both, ec);
+		socket.close(ec);
+	}
+
+	std::string pipeline(const std::string_view path, const size_t depth, const size_t extra_headers) {
+		std::string request = "GET ";
+		request += path;
+		request += " HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: ewhttp_bench\r\nAccept: */*\r\n";
+		for (size_t i = 0; i < extra_headers; i++) {
+			request += "X-Filler-";
+			request += std::to_string(i);
+			request += ": some value that is about as long as a cookie or a user agent\r\n";
+		}
+		request += "\r\n";
+		std::string result;
+		result.reserve(request.size() * depth);
+		for (size_t i = 0; i < depth; i++) result += request;
+		return result;
+	}
+
+	void pipelined_round_trips(benchmark::State &state, server_callback callback, const std::string_view path, const size_t extra_headers) {
+		LoopbackServer server{std::move(callback)};
+		Client client{server.port()};
+		const auto requests = pipeline(path, pipeline_depth, extra_headers);
+		for (auto _ : state)
+			client.round_trip(requests, pipeline_depth);
+		state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * pipeline_depth));
+		client.close();
+	}
+} // namespace ewhttp::bench
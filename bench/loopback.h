@@ -0,0 +1,70 @@
+#pragma once
+#include <ewhttp/server.h>
+
+#include <array>
+#include <asio.hpp>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <llhttp.h>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace ewhttp::bench {
+	/**
+	 * \brief A Server on a free 127.0.0.1 port, running on its own threads for as long as this exists.
+	 * Close every Client connected to it before destroying it, the server only stops once its connections are gone.
+	 */
+	class LoopbackServer {
+		Server server;
+		uint16_t port_;
+		std::jthread runner;
+
+	public:
+		explicit LoopbackServer(server_callback callback, unsigned int threads = 1, const ServerOptions &options = {});
+		LoopbackServer(const LoopbackServer &) = delete;
+		~LoopbackServer();
+
+		uint16_t port() const { return port_; }
+	};
+
+	/**
+	 * \brief One blocking connection, counts the responses coming back with llhttp.
+	 */
+	class Client {
+		asio::io_context io_context{1};
+		asio::ip::tcp::socket socket{io_context};
+		llhttp_t parser;
+		llhttp_settings_t settings;
+		std::array<char, 64 * 1024> buffer;
+
+	public:
+		// responses read so far, and the reads and bytes it took
+		size_t completed = 0, reads = 0;
+		uint64_t bytes_read = 0;
+
+		/**
+		 * \brief Connect, retrying while the server isn't listening yet.
+		 */
+		explicit Client(uint16_t port);
+		Client(const Client &) = delete;
+
+		/**
+		 * \brief Send `requests` in one write and read until `count` more responses are complete.
+		 */
+		void round_trip(std::string_view requests, size_t count);
+		void close();
+	};
+
+	/**
+	 * \brief `GET path` with `extra_headers` filler headers, repeated `depth` times back to back.
+	 */
+	std::string pipeline(std::string_view path, size_t depth, size_t extra_headers = 0);
+
+	// as many as ServerOptions::max_pipelined allows by default
+	constexpr size_t pipeline_depth = 16;
+	/**
+	 * \brief Serve `callback` on loopback and send it batches of `pipeline_depth` requests for `path` for as long as `state` runs. Counts requests as items.
+	 */
+	void pipelined_round_trips(benchmark::State &state, server_callback callback, std::string_view path, size_t extra_headers = 0);
+} // namespace ewhttp::bench
@@ -0,0 +1,23 @@
+#include "./load.h"
+
+#include <benchmark/benchmark.h>
+#include <ewhttp/server.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// `ewhttp_bench` runs the microbenchmarks, `ewhttp_bench load ...` the loopback load generator
+int main(int argc, char **argv) {
+	if (argc > 1 && std::string_view{argv[1]} == "load") {
+		const std::vector<std::string_view> args(argv + 2, argv + argc);
+		return ewhttp::bench::load(args);
+	}
+	// build with and without EWHTTP_IO_URING to compare backends
+	benchmark::AddCustomContext("io_backend", std::string{ewhttp::io_backend});
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -0,0 +1,121 @@
+#include "./loopback.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <ewhttp/router.h>
+
+namespace {
+	using namespace ewhttp::build::underscore;
+	using ewhttp::async;
+	using ewhttp::Req;
+	using ewhttp::Res;
+
+	// "segment0", "segment1", ...
+	template<size_t N>
+	constexpr auto segment_storage = [] {
+		std::array<std::array<char, 16>, N> storage{};
+		for (size_t i = 0; i < N; i++) {
+			constexpr std::string_view prefix = "segment";
+			std::ranges::copy(prefix, storage[i].begin());
+			size_t end = prefix.size();
+			std::array<char, 8> digits{};
+			size_t digit_count = 0;
+			for (size_t n = i;; n /= 10) {
+				digits[digit_count++] = static_cast<char>('0' + n % 10);
+				if (n < 10) break;
+			}
+			while (digit_count) storage[i][end++] = digits[--digit_count];
+		}
+		return storage;
+	}();
+	template<size_t N>
+	constexpr auto segments = [] {
+		std::array<std::string_view, N> views{};
+		for (size_t i = 0; i < N; i++) views[i] = segment_storage<N>[i].data();
+		return views;
+	}();
+
+	// what create_router did before NameTable: compare against every sibling in order
+	template<size_t N>
+	void BM_NameLinearScan(benchmark::State &state) {
+		const auto &names = segments<N>;
+		size_t next = 0;
+		for (auto _ : state) {
+			const auto found = std::ranges::find(names, names[next]);
+			benchmark::DoNotOptimize(found);
+			next = next + 1 == N ? 0 : next + 1;
+		}
+	}
+	template<size_t N>
+	void BM_NameTable(benchmark::State &state) {
+		const auto &names = segments<N>;
+		const ewhttp::detail::NameTable<N> table{names};
+		size_t next = 0;
+		for (auto _ : state) {
+			const auto found = table.find(names[next]);
+			benchmark::DoNotOptimize(found);
+			next = next + 1 == N ? 0 : next + 1;
+		}
+	}
+	BENCHMARK(BM_NameLinearScan<5>);
+	BENCHMARK(BM_NameLinearScan<50>);
+	BENCHMARK(BM_NameLinearScan<500>);
+	BENCHMARK(BM_NameTable<5>);
+	BENCHMARK(BM_NameTable<50>);
+	BENCHMARK(BM_NameTable<500>);
+
+	constexpr auto reply = [](Req, Res response) -> async {
+		co_await response.send_body(std::string_view{"Hello, World!"});
+	};
+
+	template<size_t... I>
+	auto wide_router(std::index_sequence<I...>) {
+		return ewhttp::create_router(_(segments<sizeof...(I)>[I], GET(reply))...);
+	}
+	template<size_t Depth>
+	constexpr auto nested() {
+		if constexpr (Depth == 0)
+			return GET(reply);
+		else
+			return _("segment0", nested<Depth - 1>());
+	}
+	std::string nested_path(const size_t depth) {
+		std::string path;
+		for (size_t i = 0; i < depth; i++) path += "/segment0";
+		return path;
+	}
+
+	// full requests over loopback, so the numbers include parsing and writing. compare against BM_RouteRoot for the routing part.
+	void BM_RouteRoot(benchmark::State &state) {
+		ewhttp::bench::pipelined_round_trips(state, ewhttp::create_router(GET(reply)), "/");
+	}
+	BENCHMARK(BM_RouteRoot)->UseRealTime();
+
+	// the last of N siblings
+	template<size_t N>
+	void BM_RouteWide(benchmark::State &state) {
+		const std::string path = "/" + std::string{segments<N>[N - 1]};
+		ewhttp::bench::pipelined_round_trips(state, wide_router(std::make_index_sequence<N>{}), path);
+	}
+	BENCHMARK(BM_RouteWide<8>)->UseRealTime();
+	BENCHMARK(BM_RouteWide<64>)->UseRealTime();
+	BENCHMARK(BM_RouteWide<500>)->UseRealTime();
+
+	template<size_t Depth>
+	void BM_RouteDeep(benchmark::State &state) {
+		ewhttp::bench::pipelined_round_trips(state, ewhttp::create_router(nested<Depth>()), nested_path(Depth));
+	}
+	BENCHMARK(BM_RouteDeep<4>)->UseRealTime();
+	BENCHMARK(BM_RouteDeep<16>)->UseRealTime();
+
+	// a path parser at every level, like "/users/:id/posts/:id"
+	void BM_RouteParsed(benchmark::State &state) {
+		constexpr auto parse = [](const std::string_view part) { return part; };
+		const auto router = ewhttp::create_router(
+				_("users", _(parse, _("posts", _(parse, GET([](Req, Res response, std::string_view, std::string_view) -> async {
+											  co_await response.send_body(std::string_view{"Hello, World!"});
+										  }))))));
+		ewhttp::bench::pipelined_round_trips(state, router, "/users/1234/posts/5678");
+	}
+	BENCHMARK(BM_RouteParsed)->UseRealTime();
+} // namespace
@@ -0,0 +1,190 @@
+#include "./loopback.h"
+
+#include <benchmark/benchmark.h>
+#include <ewhttp/router.h>
+
+namespace {
+	using namespace ewhttp::build::underscore;
+	using ewhttp::async;
+	using ewhttp::Req;
+	using ewhttp::Res;
+
+	// llhttp into Request: the same tiny response, with more and more headers to parse
+	void BM_ParseHeaders(benchmark::State &state) {
+		const auto router = ewhttp::create_router(GET([](Req, Res response) -> async {
+			co_await response.send_body(std::string_view{"Hello, World!"});
+		}));
+		ewhttp::bench::pipelined_round_trips(state, router, "/", static_cast<size_t>(state.range(0)));
+	}
+	BENCHMARK(BM_ParseHeaders)->Arg(0)->Arg(8)->Arg(32)->UseRealTime();
+
+	// BM_ParseHeaders/32, with the handler looking up a few headers: well-known ones from their slots, one by searching
+	void BM_HeaderLookup(benchmark::State &state) {
+		const auto router = ewhttp::create_router(GET([](Req request, Res response) -> async {
+			size_t found = 0;
+			for (const auto name : {"host", "user-agent", "accept-encoding", "x-filler-31"})
+				found += request.header(name).has_value();
+			benchmark::DoNotOptimize(found);
+			co_await response.send_body(std::string_view{"Hello, World!"});
+		}));
+		ewhttp::bench::pipelined_round_trips(state, router, "/", 32);
+	}
+	BENCHMARK(BM_HeaderLookup)->UseRealTime();
+
+	// the query string parsed and decoded on the first lookup, with nothing (0) or some values (1) to unescape
+	void BM_QueryParams(benchmark::State &state) {
+		const auto router = ewhttp::create_router(GET([](Req request, Res response) -> async {
+			benchmark::DoNotOptimize(request.query_param("page"));
+			co_await response.send_body(std::string_view{"Hello, World!"});
+		}));
+		const auto path = state.range(0) ? "/?q=hello%20world&sort=date%2Cdesc&page=2" : "/?q=hello&sort=date&page=2";
+		ewhttp::bench::pipelined_round_trips(state, router, path);
+	}
+	BENCHMARK(BM_QueryParams)->ArgName("escaped")->Arg(0)->Arg(1)->UseRealTime();
+
+	// Response::send_headers with range(0) headers added one by one. 204, so the client knows there's no body.
+	void BM_SendHeaders(benchmark::State &state) {
+		const auto count = static_cast<size_t>(state.range(0));
+		const auto router = ewhttp::create_router(GET([count](Req, Res response) -> async {
+			response.status = 204;
+			for (size_t i = 0; i < count; i++) response.add_header("X-Header", "some value");
+			co_await response.send_headers();
+		}));
+		ewhttp::bench::pipelined_round_trips(state, router, "/");
+	}
+	BENCHMARK(BM_SendHeaders)->Arg(1)->Arg(8)->Arg(32)->UseRealTime();
+
+	// the same 8 headers as BM_SendHeaders/8, serialized once up front
+	void BM_SendHeaderBlock(benchmark::State &state) {
+		static const ewhttp::HeaderBlock block{{"X-Header", "some value"}, {"X-Header", "some value"}, {"X-Header", "some value"}, {"X-Header", "some value"}, {"X-Header", "some value"}, {"X-Header", "some value"}, {"X-Header", "some value"}, {"X-Header", "some value"}};
+		const auto router = ewhttp::create_router(GET([](Req, Res response) -> async {
+			response.status = 204;
+			response.add_headers(block);
+			co_await response.send_headers();
+		}));
+		ewhttp::bench::pipelined_round_trips(state, router, "/");
+	}
+	BENCHMARK(BM_SendHeaderBlock)->UseRealTime();
+
+	// send_body with a range(0) byte body
+	void BM_SendBody(benchmark::State &state) {
+		const std::string body(static_cast<size_t>(state.range(0)), 'x');
+		const auto router = ewhttp::create_router(GET([&body](Req, Res response) -> async {
+			co_await response.send_body(std::span<const char>{body});
+		}));
+		ewhttp::bench::pipelined_round_trips(state, router, "/");
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * ewhttp::bench::pipeline_depth * body.size()));
+	}
+	BENCHMARK(BM_SendBody)->Arg(16)->Arg(4 * 1024)->Arg(64 * 1024)->UseRealTime();
+
+	// range(0) small writes through Response::stream(), coalesced into 16KiB chunks
+	void BM_StreamWrites(benchmark::State &state) {
+		const auto count = static_cast<size_t>(state.range(0));
+		const auto router = ewhttp::create_router(GET([count](Req, Res response) -> async {
+			constexpr std::string_view line = "{\"id\":12345,\"name\":\"something\"}\n";
+			auto body = response.stream();
+			for (size_t i = 0; i < count; i++) co_await body.write(line);
+			co_await body.finish();
+		}));
+		ewhttp::bench::pipelined_round_trips(state, router, "/");
+		state.counters["writes"] = benchmark::Counter(static_cast<double>(state.iterations() * ewhttp::bench::pipeline_depth * count), benchmark::Counter::kIsRate);
+	}
+	BENCHMARK(BM_StreamWrites)->Arg(16)->Arg(1024)->UseRealTime();
+
+	// range(0) Server-Sent Events per response, flushed once at the end
+	void BM_EventStream(benchmark::State &state) {
+		const auto count = static_cast<size_t>(state.range(0));
+		const auto router = ewhttp::create_router(GET([count](Req, Res response) -> async {
+			auto events = response.event_stream();
+			for (size_t i = 0; i < count; i++) co_await events.send("some data\nmore data", "update");
+			co_await events.finish();
+		}));
+		ewhttp::bench::pipelined_round_trips(state, router, "/");
+		state.counters["events"] = benchmark::Counter(static_cast<double>(state.iterations() * ewhttp::bench::pipeline_depth * count), benchmark::Counter::kIsRate);
+	}
+	BENCHMARK(BM_EventStream)->Arg(16)->Arg(1024)->UseRealTime();
+
+	// a formatted 4KiB body, built every time (0) or replayed through _.cache (1)
+	void BM_CachedBody(benchmark::State &state) {
+		const auto build = [](Req, Res response) -> async {
+			std::string body;
+			for (int i = 0; body.size() < 4096; i++) body += std::to_string(i) + ", ";
+			response.add_header("Content-Type", "text/plain");
+			co_await response.send_body(std::span<const char>{body});
+		};
+		if (state.range(0) == 1)
+			ewhttp::bench::pipelined_round_trips(state, ewhttp::create_router(GET(_.cache(build))), "/");
+		else
+			ewhttp::bench::pipelined_round_trips(state, ewhttp::create_router(GET(build)), "/");
+	}
+	BENCHMARK(BM_CachedBody)->ArgName("cached")->Arg(0)->Arg(1)->UseRealTime();
+
+	// the same tiny response, without (0) or behind (1) an adaptive concurrency limit that never fills up
+	void BM_Limited(benchmark::State &state) {
+		const auto hello = GET([](Req, Res response) -> async {
+			co_await response.send_body(std::string_view{"Hello, World!"});
+		});
+		if (state.range(0) == 1)
+			ewhttp::bench::pipelined_round_trips(state, ewhttp::create_router(_.limit(), hello), "/");
+		else
+			ewhttp::bench::pipelined_round_trips(state, ewhttp::create_router(hello), "/");
+	}
+	BENCHMARK(BM_Limited)->ArgName("limited")->Arg(0)->Arg(1)->UseRealTime();
+
+	// the same tiny response, without (0) or behind (1) a per-client rate limit that's never reached
+	void BM_RateLimited(benchmark::State &state) {
+		const auto hello = GET([](Req, Res response) -> async {
+			co_await response.send_body(std::string_view{"Hello, World!"});
+		});
+		if (state.range(0) == 1)
+			ewhttp::bench::pipelined_round_trips(state, ewhttp::create_router(_.rate_limit({.rate = 1e9, .burst = 4095}), hello), "/");
+		else
+			ewhttp::bench::pipelined_round_trips(state, ewhttp::create_router(hello), "/");
+	}
+	BENCHMARK(BM_RateLimited)->ArgName("limited")->Arg(0)->Arg(1)->UseRealTime();
+
+	// a new connection for every request, mostly accept and connection setup
+	void BM_Reconnect(benchmark::State &state) {
+		ewhttp::bench::LoopbackServer server{ewhttp::create_router(GET([](Req, Res response) -> async {
+			co_await response.send_body(std::string_view{"Hello, World!"});
+		}))};
+		const auto request = ewhttp::bench::pipeline("/", 1);
+		for (auto _ : state) {
+			ewhttp::bench::Client client{server.port()};
+			client.round_trip(request, 1);
+			client.close();
+		}
+		state.SetItemsProcessed(state.iterations());
+	}
+	BENCHMARK(BM_Reconnect)->UseRealTime();
+
+	// a 512 byte response per round trip through Response: status line, headers and body in one gathered write (range(0) == 1),
+	// or the headers sent on their own before the body (0), the way every response went out before. the counters are from the
+	// client's side, loopback with TCP_NODELAY usually delivers each write as its own read. for exact syscall counts, run it under
+	// `strace -f -c -e trace=write,writev,sendmsg,sendto ewhttp_bench --benchmark_filter=BM_ResponseWrites`.
+	void BM_ResponseWrites(benchmark::State &state) {
+		const bool gathered = state.range(0) == 1;
+		static const std::string body(512, 'x');
+		ewhttp::bench::LoopbackServer server{ewhttp::create_router(GET([gathered](Req, Res response) -> async {
+			response.add_header("Content-Type", "text/plain");
+			if (gathered) {
+				co_await response.send_body(std::string_view{body});
+				co_return;
+			}
+			response.set_header("Content-Length", "512");
+			co_await response.send_headers();
+			auto writer = response.stream();
+			co_await writer.write(body);
+			co_await writer.finish();
+		}))};
+		ewhttp::bench::Client client{server.port()};
+		const auto request = ewhttp::bench::pipeline("/", 1);
+		for (auto _ : state)
+			client.round_trip(request, 1);
+		state.SetItemsProcessed(state.iterations());
+		state.counters["reads_per_response"] = benchmark::Counter(static_cast<double>(client.reads), benchmark::Counter::kAvgIterations);
+		state.counters["bytes_per_read"] = client.reads ? static_cast<double>(client.bytes_read) / static_cast<double>(client.reads) : 0;
+		client.close();
+	}
+	BENCHMARK(BM_ResponseWrites)->ArgName("gathered")->Arg(0)->Arg(1)->UseRealTime();
+} // namespace
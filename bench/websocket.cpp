@@ -0,0 +1,15 @@
+#include <benchmark/benchmark.h>
+#include <ewhttp/websocket.h>
+
+namespace {
+	// unmasking a client frame's payload in place, range(0) bytes
+	void BM_WebSocketUnmask(benchmark::State &state) {
+		std::string payload(static_cast<size_t>(state.range(0)), 'x');
+		for (auto _ : state) {
+			ewhttp::websocket::detail::unmask(payload, {0x12, 0x34, 0x56, 0x78});
+			benchmark::DoNotOptimize(payload.data());
+		}
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payload.size()));
+	}
+	BENCHMARK(BM_WebSocketUnmask)->Arg(16)->Arg(1024)->Arg(64 * 1024);
+} // namespace
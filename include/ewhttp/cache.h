@@ -0,0 +1,78 @@
+#pragma once
+#include "./request.h"
+#include "./response.h"
+
+#include <chrono>
+#include <concepts>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace ewhttp {
+	namespace build {
+		struct CacheOptions {
+			// how long a stored response is replayed before the handler runs again
+			std::chrono::milliseconds ttl = std::chrono::seconds{60};
+			// total bytes of stored responses, split evenly between the shards. least recently used ones are dropped first.
+			size_t max_size = 64 * 1024 * 1024;
+			// larger responses are sent, but not stored. they're held back until they pass this size, then the rest goes out as it's written.
+			size_t max_entry_size = 1024 * 1024;
+			// how long a request waits for another one building the same entry, before running the handler itself
+			std::chrono::milliseconds max_wait = std::chrono::seconds{5};
+			// request headers that select between different responses for the same path (like Accept-Encoding), compared as-is
+			std::vector<std::string> vary{};
+			// independently locked parts of the cache, so threads rarely wait on each other
+			size_t shards = 16;
+		};
+	} // namespace build
+
+	namespace detail {
+		struct CacheStore; // cache.cpp
+		// one request's job of building a missing entry. other requests for the same key wait until it's done.
+		struct CacheFill;
+		struct CacheFillEnd {
+			void operator()(CacheFill *fill) const;
+		};
+		using CacheFillPtr = std::unique_ptr<CacheFill, CacheFillEnd>;
+
+		std::shared_ptr<CacheStore> make_cache_store(const build::CacheOptions &options);
+		/**
+		 * \brief Sends the stored response for `request`, first waiting for it if another request is building it right now.
+		 * Keys whose last response couldn't be stored, and requests that waited CacheOptions::max_wait, skip the cache and don't wait.
+		 * \return nullptr if a response was sent. Otherwise the handler runs, and if this request builds the entry what it sends to `response` is held back until cache_store.
+		 */
+		awaitable<CacheFillPtr> cache_lookup(CacheStore &store, Req request, Res response);
+		/**
+		 * \brief Sends the response that was held back, and stores it if it's complete, small enough, and allowed to be cached.
+		 */
+		async cache_store(CacheFillPtr fill, Res response);
+	} // namespace detail
+
+	namespace build {
+		/**
+		 * \brief Runs `handler` once per TTL for each method, path and set of `CacheOptions::vary` header values, and replays its response (status line, headers and body, in one write) in between.
+		 * Only complete responses with a cacheable status and without `Cache-Control: no-store/private` or `Set-Cookie` are stored.
+		 */
+		template<class H>
+		struct Cache {
+			H handler;
+			// shared between copies of this handler
+			std::shared_ptr<detail::CacheStore> store;
+
+			Cache(H handler, const CacheOptions &options = {}) : handler{handler}, store{detail::make_cache_store(options)} {}
+
+			template<class... Parts>
+				requires std::invocable<const H &, Request &, Response &, Parts...>
+			async operator()(Req request, Res response, Parts... parts) const {
+				auto fill = co_await detail::cache_lookup(*store, request, response);
+				if (!fill) co_return;
+				if constexpr (std::is_void_v<std::invoke_result_t<const H &, Request &, Response &, Parts...>>)
+					handler(request, response, parts...);
+				else
+					co_await handler(request, response, parts...);
+				co_await detail::cache_store(std::move(fill), response);
+			}
+		};
+	} // namespace build
+} // namespace ewhttp
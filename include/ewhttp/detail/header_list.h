@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ewhttp::detail {
+	constexpr char ascii_lower(const char c) {
+		return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+	}
+	// ascii_lower on 8 bytes at once
+	inline uint64_t ascii_lower_word(const uint64_t word) {
+		constexpr uint64_t ones = 0x0101010101010101ull, high = ones * 0x80;
+		// per byte: the high bit of `heptets + (0x80 - c)` is set if the byte is at least c. no carries, heptets are below 0x80.
+		const uint64_t heptets = word & ~high;
+		const uint64_t upper = (heptets + ones * (0x80 - 'A')) & ~(heptets + ones * (0x80 - 'Z' - 1)) & ~word & high;
+		return word | upper >> 2;
+	}
+#ifdef __SSE2__
+	inline __m128i ascii_lower_vector(const __m128i bytes) {
+		// signed compares, so bytes above 0x7f are never in range
+		const auto upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+		return _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+	}
+#endif
+	// case-insensitive comparison of `size` bytes, 16 (SSE2) or 8 at a time
+	inline bool iequals_bytes(const char *a, const char *b, size_t size) {
+#ifdef __SSE2__
+		for (; size >= 16; a += 16, b += 16, size -= 16) {
+			const auto x = ascii_lower_vector(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)));
+			const auto y = ascii_lower_vector(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b)));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff) return false;
+		}
+#endif
+		uint64_t x, y;
+		for (; size >= 8; a += 8, b += 8, size -= 8) {
+			std::memcpy(&x, a, 8);
+			std::memcpy(&y, b, 8);
+			if (ascii_lower_word(x) != ascii_lower_word(y)) return false;
+		}
+		if (size == 0) return true;
+		x = y = 0;
+		std::memcpy(&x, a, size);
+		std::memcpy(&y, b, size);
+		return ascii_lower_word(x) == ascii_lower_word(y);
+	}
+	// ascii case-insensitive equality, for header names
+	constexpr bool iequals(const std::string_view a, const std::string_view b) {
+		if (a.size() != b.size()) return false;
+		if consteval {
+			return std::ranges::equal(a, b, [](const char x, const char y) { return ascii_lower(x) == ascii_lower(y); });
+		} else {
+			return iequals_bytes(a.data(), b.data(), a.size());
+		}
+	}
+
+	// bytes stored inline up to N, on the heap past that
+	template<size_t N>
+	class small_buffer {
+		std::array<char, N> local;
+		std::unique_ptr<char[]> heap{};
+		size_t length = 0, capacity = N;
+
+		void reserve(const size_t needed) {
+			if (needed <= capacity) return;
+			const size_t new_capacity = std::max(needed, capacity * 2);
+			auto grown = std::make_unique<char[]>(new_capacity);
+			std::memcpy(grown.get(), data(), length);
+			heap = std::move(grown);
+			capacity = new_capacity;
+		}
+
+	public:
+		char *data() { return heap ? heap.get() : local.data(); }
+		const char *data() const { return heap ? heap.get() : local.data(); }
+		size_t size() const { return length; }
+		std::string_view view() const { return {data(), length}; }
+
+		void append(const std::string_view bytes) {
+			reserve(length + bytes.size());
+			std::memcpy(data() + length, bytes.data(), bytes.size());
+			length += bytes.size();
+		}
+		void erase(const size_t pos, const size_t count) {
+			std::memmove(data() + pos, data() + pos + count, length - pos - count);
+			length -= count;
+		}
+		void clear() { length = 0; }
+	};
+
+	// headers stored pre-serialized, as consecutive "Key: Value\r\n" lines
+	class HeaderList {
+		small_buffer<512> lines;
+
+		/**
+		 * \brief Call `callback(line_start, line_size, key, value)` for every line. Returns early if the callback returns true.
+		 */
+		template<class F>
+		bool each(F callback) const {
+			const auto all = lines.view();
+			size_t pos = 0;
+			while (pos < all.size()) {
+				// add_serialized lines may end without a CRLF, or have no space (or more than one) after the colon
+				auto end = all.find("\r\n", pos);
+				const auto line = all.substr(pos, end - pos);
+				end = end == std::string_view::npos ? all.size() : end + 2;
+				const auto colon = line.find(':');
+				auto value = colon == std::string_view::npos ? std::string_view{} : line.substr(colon + 1);
+				while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+				if (callback(pos, end - pos, line.substr(0, colon), value))
+					return true;
+				pos = end;
+			}
+			return false;
+		}
+
+	public:
+		void add(const std::string_view key, const std::string_view value) {
+			lines.append(key);
+			lines.append(": ");
+			lines.append(value);
+			lines.append("\r\n");
+		}
+		// splice already serialized lines in as-is
+		void add_serialized(const std::string_view serialized) { lines.append(serialized); }
+
+		bool contains(const std::string_view key) const {
+			return each([&](size_t, size_t, const std::string_view k, std::string_view) { return iequals(k, key); });
+		}
+		/**
+		 * \brief Call `callback(value)` for every value of `key`.
+		 */
+		template<class F>
+		void values(const std::string_view key, F callback) const {
+			each([&](size_t, size_t, const std::string_view k, const std::string_view v) {
+				if (iequals(k, key)) callback(v);
+				return false;
+			});
+		}
+		// returns the amount of lines removed
+		size_t remove(const std::string_view key) {
+			size_t removed = 0;
+			// restart after every erase, positions shift
+			while (each([&](const size_t start, const size_t size, const std::string_view k, std::string_view) {
+				if (!iequals(k, key)) return false;
+				lines.erase(start, size);
+				return true;
+			}))
+				removed++;
+			return removed;
+		}
+		void clear() { lines.clear(); }
+		std::string_view serialized() const { return lines.view(); }
+	};
+} // namespace ewhttp::detail
@@ -0,0 +1,73 @@
+#pragma once
+#include "../method.h"
+
+#include <array>
+#include <limits>
+#include <string_view>
+
+namespace ewhttp::detail {
+	/**
+	 * \brief The method handlers of one router level, indexed by MethodT::id. Constructible at compile time.
+	 * Also knows the Allow header for the level: every method with a handler, HEAD if there's GET, and OPTIONS.
+	 */
+	template<size_t N>
+	class MethodTable {
+	public:
+		static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+	private:
+		// method id -> first handler index for it, or npos
+		std::array<size_t, method_names.size()> first{};
+		// handler index -> next handler index with the same method, or npos
+		std::array<size_t, N> next_same{};
+		// "GET, HEAD, OPTIONS"
+		std::array<char, [] {
+			size_t size = 0;
+			for (const auto name : method_names) size += name.size() + 2;
+			return size;
+		}()> allowed{};
+		size_t allowed_size = 0;
+
+		constexpr void add_allowed(const std::string_view name) {
+			if (allowed_size) {
+				allowed[allowed_size++] = ',';
+				allowed[allowed_size++] = ' ';
+			}
+			for (const char c : name) allowed[allowed_size++] = c;
+		}
+
+	public:
+		constexpr explicit MethodTable(const std::array<MethodT, N> &methods) {
+			first.fill(npos);
+			next_same.fill(npos);
+			for (size_t i = 0; i < N; i++) {
+				if (methods[i].id >= first.size()) continue; // not a method requests can have
+				auto *last = &first[methods[i].id];
+				while (*last != npos) last = &next_same[*last];
+				*last = i;
+			}
+			for (uint8_t id = 0; id < method_names.size(); id++) {
+				const MethodT method{id};
+				if (first[id] != npos || (method == Method::HEAD && first[Method::GET.id] != npos) || method == Method::OPTIONS)
+					add_allowed(method_names[id]);
+			}
+		}
+
+		/**
+		 * \return Index of the first handler for `method`, or npos. HEAD falls back to the GET handlers.
+		 */
+		constexpr size_t find(const MethodT method) const {
+			if (method.id >= first.size()) return npos;
+			if (first[method.id] == npos && method == Method::HEAD) return first[Method::GET.id];
+			return first[method.id];
+		}
+		/**
+		 * \return The next index after `index` with the same method, or npos.
+		 */
+		constexpr size_t next(const size_t index) const { return next_same[index]; }
+		/**
+		 * \return Value for the Allow header.
+		 */
+		constexpr std::string_view allow() const { return {allowed.data(), allowed_size}; }
+	};
+} // namespace ewhttp::detail
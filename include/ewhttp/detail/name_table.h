@@ -0,0 +1,128 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <utility>
+
+namespace ewhttp::detail {
+	// FNV-1a, one pass over the string
+	constexpr uint64_t name_hash(const std::string_view str) {
+		uint64_t hash = 14695981039346656037ull;
+		for (const char c : str)
+			hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+		return hash;
+	}
+	// spread `hash` differently for every displacement
+	constexpr uint64_t displace(uint64_t hash, const uint32_t displacement) {
+		hash ^= displacement * 0x9e3779b97f4a7c15ull;
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	/**
+	 * \brief Perfect hash from N names to their index, built with hash-and-displace. Constructible at compile time.
+	 * Lookups hash the string once and compare against at most one name.
+	 */
+	template<size_t N>
+	class NameTable {
+	public:
+		static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+	private:
+		static constexpr size_t slot_count = std::bit_ceil(N * 2 + 1);
+		static constexpr size_t bucket_count = N / 4 + 1;
+
+		std::array<std::string_view, N> names{};
+		// slot -> index into names, or npos
+		std::array<size_t, slot_count> slots{};
+		// bucket -> displacement that gave every name in it a free slot
+		std::array<uint32_t, bucket_count> displacements{};
+		// index -> next index with the same name, or npos. the table itself only holds the first of every name.
+		std::array<size_t, N> next_same{};
+
+		static constexpr size_t slot_of(const uint64_t hash, const uint32_t displacement) {
+			return displace(hash, displacement) & (slot_count - 1);
+		}
+
+	public:
+		constexpr explicit NameTable(const std::array<std::string_view, N> &names) : names{names} {
+			slots.fill(npos);
+			next_same.fill(npos);
+			// unique names, duplicates are chained behind the first
+			std::array<bool, N> unique{};
+			for (size_t i = 0; i < N; i++) {
+				unique[i] = true;
+				for (size_t j = i; j-- > 0;)
+					if (names[j] == names[i]) {
+						unique[i] = false;
+						size_t last = j;
+						while (next_same[last] != npos) last = next_same[last];
+						next_same[last] = i;
+						break;
+					}
+			}
+			std::array<uint64_t, N> hashes{};
+			std::array<size_t, bucket_count> bucket_sizes{};
+			for (size_t i = 0; i < N; i++) {
+				hashes[i] = name_hash(names[i]);
+				if (unique[i]) bucket_sizes[hashes[i] % bucket_count]++;
+			}
+			// names grouped by bucket (counting sort), bucket b is members[bucket_starts[b] .. bucket_starts[b + 1]]
+			std::array<size_t, bucket_count + 1> bucket_starts{};
+			for (size_t b = 0; b < bucket_count; b++) bucket_starts[b + 1] = bucket_starts[b] + bucket_sizes[b];
+			std::array<size_t, N> members{};
+			std::array<size_t, bucket_count> filled{};
+			for (size_t i = 0; i < N; i++)
+				if (unique[i]) {
+					const auto bucket = hashes[i] % bucket_count;
+					members[bucket_starts[bucket] + filled[bucket]++] = i;
+				}
+			// biggest buckets first, they're the hardest to place
+			std::array<size_t, bucket_count> order{};
+			for (size_t b = 0; b < bucket_count; b++) order[b] = b;
+			for (size_t a = 0; a < bucket_count; a++)
+				for (size_t b = a + 1; b < bucket_count; b++)
+					if (bucket_sizes[order[b]] > bucket_sizes[order[a]]) std::swap(order[a], order[b]);
+
+			for (const size_t bucket : order) {
+				if (bucket_sizes[bucket] == 0) break;
+				for (uint32_t displacement = 0;; displacement++) {
+					// try to give every name of this bucket a free slot, undo if one collides
+					size_t placed = 0;
+					for (size_t m = bucket_starts[bucket]; m < bucket_starts[bucket + 1]; m++, placed++) {
+						const auto slot = slot_of(hashes[members[m]], displacement);
+						if (slots[slot] != npos) break;
+						slots[slot] = members[m];
+					}
+					if (placed == bucket_sizes[bucket]) {
+						displacements[bucket] = displacement;
+						break;
+					}
+					for (size_t m = bucket_starts[bucket]; m < bucket_starts[bucket] + placed; m++)
+						slots[slot_of(hashes[members[m]], displacement)] = npos;
+				}
+			}
+		}
+
+		/**
+		 * \return Index of the first name equal to `str`, or npos.
+		 */
+		constexpr size_t find(const std::string_view str) const {
+			if constexpr (N == 0) {
+				return npos;
+			} else {
+				const auto hash = name_hash(str);
+				const auto index = slots[slot_of(hash, displacements[hash % bucket_count])];
+				return index != npos && names[index] == str ? index : npos;
+			}
+		}
+		/**
+		 * \return The next index after `index` with the same name, or npos.
+		 */
+		constexpr size_t next(const size_t index) const { return next_same[index]; }
+	};
+} // namespace ewhttp::detail
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <memory_resource>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ewhttp::detail {
+	// the index of the first '%' (or '+' if `plus` is set) in `bytes`, checking 16 at a time with SSE2. bytes.size() if there is none.
+	inline size_t find_escape(const std::string_view bytes, const bool plus) {
+		size_t i = 0;
+#ifdef __SSE2__
+		const auto percent = _mm_set1_epi8('%'), plus_sign = _mm_set1_epi8(plus ? '+' : '%');
+		for (; i + 16 <= bytes.size(); i += 16) {
+			const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes.data() + i));
+			const auto found = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, percent), _mm_cmpeq_epi8(chunk, plus_sign)));
+			if (found != 0)
+				return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned int>(found)));
+		}
+#endif
+		for (; i < bytes.size(); i++)
+			if (bytes[i] == '%' || (plus && bytes[i] == '+'))
+				return i;
+		return bytes.size();
+	}
+
+	constexpr int hex_digit(const char c) {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	/**
+	 * \brief Decode %XX escapes (and '+' as a space, if `plus` is set). Malformed escapes are kept as they are.
+	 * \return `encoded` itself if there was nothing to decode, otherwise a copy in `memory`
+	 */
+	inline std::string_view percent_decode(const std::string_view encoded, const bool plus, std::pmr::memory_resource &memory) {
+		size_t in = find_escape(encoded, plus);
+		if (in == encoded.size())
+			return encoded;
+		// decoding only ever shrinks
+		const auto out = static_cast<char *>(memory.allocate(encoded.size(), 1));
+		std::memcpy(out, encoded.data(), in);
+		size_t written = in;
+		while (in < encoded.size()) {
+			const char c = encoded[in];
+			if (c == '%' && in + 2 < encoded.size() && hex_digit(encoded[in + 1]) >= 0 && hex_digit(encoded[in + 2]) >= 0) {
+				out[written++] = static_cast<char>(hex_digit(encoded[in + 1]) << 4 | hex_digit(encoded[in + 2]));
+				in += 3;
+			} else {
+				out[written++] = plus && c == '+' ? ' ' : c;
+				in++;
+			}
+			// copy the stretch up to the next escape in one go
+			const auto next = in + find_escape(encoded.substr(in), plus);
+			std::memcpy(out + written, encoded.data() + in, next - in);
+			written += next - in;
+			in = next;
+		}
+		return {out, written};
+	}
+} // namespace ewhttp::detail
@@ -1,9 +1,14 @@
 #pragma once
+#include "./cache.h"
 #include "./files.h"
+#include "./limit.h"
+#include "./metrics.h"
 #include "./method.h"
+#include "./rate_limit.h"
 #include "./request.h"
 #include "./response.h"
 #include "./router.h"
 #include "./server.h"
 #include "./status.h"
-#include "./version.h"
\ No newline at end of file
+#include "./version.h"
+#include "./websocket.h"
\ No newline at end of file
@@ -3,7 +3,12 @@
 #include "./request.h"
 #include "./response.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <memory>
+#include <string>
 #include <variant>
 #include <vector>
 
@@ -17,17 +22,65 @@ namespace ewhttp {
 			std::filesystem::path path;
 			uintmax_t size;
 		};
-		using File = std::variant<MemoryFile, StreamingFile>;
+		// Content-Encoding, in order of preference when the client likes several equally
+		enum class Encoding : uint8_t {
+			br,
+			zstd,
+			gzip,
+		};
+		constexpr std::array<std::string_view, 3> encoding_names{"br", "zstd", "gzip"};
+		constexpr std::array<std::string_view, 3> encoding_extensions{".br", ".zst", ".gz"};
+
+		// a precompressed copy of a File
+		struct EncodedFile {
+			Encoding encoding;
+			std::variant<MemoryFile, StreamingFile> contents;
+			uintmax_t size;
+			std::string etag; // differs from the identity etag, they're different representations
+		};
+		struct File {
+			std::variant<MemoryFile, StreamingFile> contents;
+			uintmax_t size;
+			// computed once when loading. strong etag from the contents for memory files, from size + modification time for streaming files.
+			std::string etag;
+			std::chrono::system_clock::time_point modified;
+			std::string last_modified; // `modified` as an HTTP date
+			std::vector<EncodedFile> encoded{};
+			// requests since the last rebalance, decides what stays in memory under FilesOptions::max_memory_total
+			mutable std::atomic<uint32_t> hits{0};
+
+			// bytes this file keeps in memory, including compressed variants
+			uintmax_t memory_size() const;
+		};
+		struct FileStore; // files.cpp
 	} // namespace detail
 	namespace build {
 		struct FilesOptions {
 			uintmax_t max_memory_cached = 8'388'608; // 8mb
+			// compress files that are cached in memory when loading (with whichever of brotli/zstd/gzip ewhttp was built with). sibling .br/.zst/.gz files on disk are always used.
+			bool compress = true;
+			// don't bother compressing files smaller than this
+			uintmax_t min_compress_size = 256;
+			// compression levels, also used when reloading changed files. the maximums (11, 19+, 9) take much longer for a few percent.
+			int brotli_quality = 5; // 0-11
+			int zstd_level = 3;     // 1-22
+			int gzip_level = 6;     // 1-9
+			// total bytes kept in memory across all files, 0 for no limit. with a limit, frequently requested files are moved into memory and rarely requested ones out of it, in the background.
+			uintmax_t max_memory_total = 0;
+			// apply changes to the directory as they happen (inotify, linux only), instead of only reading it once
+			bool watch = false;
 		};
 
 		struct Files {
-			detail::string_map<detail::File> files;
+			// shared between copies of this handler (and the background thread, if there is one)
+			std::shared_ptr<detail::FileStore> store;
 			Files(std::string_view path_to_root, const FilesOptions &options = {});
-			async operator()(Req request, Res response, const size_t path_progress);
+			async operator()(Req request, Res response, const size_t path_progress) const;
+			/**
+			 * \brief Look up a file by its path relative to the root.
+			 * \return The file as it is right now, or nullptr. Stays valid even if the file is replaced or removed meanwhile.
+			 */
+			std::shared_ptr<const detail::File> find(std::string_view path) const;
 		};
 	} // namespace build
 } // namespace ewhttp
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+#include "./request.h"
+#include "./response.h"
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+namespace ewhttp {
+	namespace build {
+		struct LimitOptions {
+			// concurrent requests allowed at first, and the bounds the limit adapts within
+			size_t initial_limit = 32, min_limit = 4, max_limit = 1024;
+			// requests beyond the limit wait here. once it's full, new ones are answered with 503 right away.
+			size_t max_queue = 128;
+			// how long a request may wait for a slot before it's answered with 503
+			std::chrono::milliseconds queue_timeout{100};
+			// seconds, sent as Retry-After with the 503
+			unsigned int retry_after = 1;
+			// how much slower recent requests may get compared to the long-term average before the limit shrinks
+			double tolerance = 1.5;
+		};
+	} // namespace build
+
+	namespace detail {
+		class ConcurrencyLimiter; // limit.cpp
+		// a slot held by an admitted request, in its arena. given back when its Response is destroyed.
+		struct Admission {
+			ConcurrencyLimiter *limiter;
+			std::chrono::steady_clock::time_point start;
+			Admission *next;
+		};
+		void release(const Admission &admission);
+	} // namespace detail
+
+	namespace build {
+		/**
+		 * \brief Always handler that admits only as many requests at a time as the routes after it can handle, adapting the limit to their latency:
+		 * once recent requests take `tolerance` times longer than usual, the limit shrinks, while latency holds it grows.
+		 * Requests over the limit queue for up to `queue_timeout`, those that don't get a slot are answered with a pre-serialized 503 and Retry-After.
+		 * Place it at the root to limit everything, or inside a Name to limit that subtree. Copies share the same limit.
+		 */
+		struct Limit {
+			std::shared_ptr<detail::ConcurrencyLimiter> limiter;
+
+			explicit Limit(const LimitOptions &options = {});
+			std::optional<async> admit(Req request, Res response) const;
+			template<class... Parts>
+			std::optional<async> operator()(Req request, Res response, const Parts &...) const {
+				return admit(request, response);
+			}
+
+			// requests admitted right now
+			size_t in_flight() const;
+			// the limit right now
+			size_t limit() const;
+		};
+	} // namespace build
+} // namespace ewhttp
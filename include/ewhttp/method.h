@@ -23,10 +23,10 @@ namespace ewhttp {
 		std::uint_fast8_t id;
 		constexpr MethodT(const std::uint_fast8_t id) : id{id} {}
 
-		auto operator<=>(const MethodT &other) const {
+		constexpr auto operator<=>(const MethodT &other) const {
 			return id <=> other.id;
 		}
-		auto operator==(const MethodT &other) const {
+		constexpr auto operator==(const MethodT &other) const {
 			return id == other.id;
 		}
 
@@ -0,0 +1,119 @@
+#pragma once
+#include "./method.h"
+#include "./request.h"
+#include "./response.h"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ewhttp {
+	namespace detail {
+		// a route pattern like "/users/:param", interned for the lifetime of the program
+		struct RouteLabel {
+			std::string_view name;
+			// dense, starting at 0 for requests that didn't go through a router
+			size_t id;
+		};
+		/**
+		 * \brief Get the label for `name`, creating it the first time. Takes a lock, meant for setting up routers.
+		 */
+		const RouteLabel *intern_route(std::string_view name);
+
+		// written by one thread only, so adding is a plain load and store. read from anywhere.
+		class Counter {
+			std::atomic<uint64_t> value{0};
+
+		public:
+			void add(const uint64_t amount = 1) { value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed); }
+			uint64_t get() const { return value.load(std::memory_order_relaxed); }
+		};
+
+		/**
+		 * \brief Latency histogram over microseconds with HDR-style buckets: every power of two is split into `sub_buckets` linear ones, so the error stays under 1/sub_buckets at any scale.
+		 */
+		class Histogram {
+		public:
+			static constexpr size_t sub_bucket_bits = 3, sub_buckets = 1 << sub_bucket_bits;
+			// up to 2^28us, about 4.5 minutes. anything longer lands in the last bucket.
+			static constexpr size_t powers = 28;
+			static constexpr size_t bucket_count = powers * sub_buckets;
+
+			static constexpr size_t bucket_of(const uint64_t micros) {
+				if (micros < sub_buckets)
+					return micros;
+				const auto shift = static_cast<size_t>(std::bit_width(micros)) - 1 - sub_bucket_bits;
+				const auto bucket = (shift + 1) * sub_buckets + ((micros >> shift) & (sub_buckets - 1));
+				return bucket < bucket_count ? bucket : bucket_count - 1;
+			}
+			// exclusive
+			static constexpr uint64_t upper_bound(const size_t bucket) {
+				if (bucket < sub_buckets)
+					return bucket + 1;
+				const auto shift = bucket / sub_buckets - 1;
+				return (sub_buckets + bucket % sub_buckets + 1) << shift;
+			}
+
+			std::array<Counter, bucket_count> buckets{};
+			Counter count{}, sum_micros{};
+
+			void record(const uint64_t micros) {
+				buckets[bucket_of(micros)].add();
+				count.add();
+				sum_micros.add(micros);
+			}
+		};
+		static_assert(Histogram::bucket_of(7) == 7 && Histogram::bucket_of(8) == 8 && Histogram::bucket_of(17) == 16 && Histogram::upper_bound(16) == 18);
+
+		// latency of one route, per method
+		struct RouteStats {
+			std::array<Histogram, method_names.size()> methods{};
+		};
+
+		/**
+		 * \brief Everything one thread counts. Threads only ever write their own, readers add all of them up.
+		 */
+		struct ThreadMetrics {
+			static constexpr size_t max_routes = 1024;
+			// llhttp_errno values
+			static constexpr size_t parse_error_codes = 64;
+
+			Counter requests{}, bytes_in{}, bytes_out{}, connections_opened{}, connections_closed{}, handler_exceptions{};
+			// 1xx to 5xx, anything else in [0]
+			std::array<Counter, 6> responses{};
+			std::array<Counter, parse_error_codes> parse_errors{};
+			// RouteLabel::id -> stats, allocated by the owning thread on first use and never freed
+			std::array<std::atomic<RouteStats *>, max_routes> routes{};
+
+			/**
+			 * \brief Count a finished request.
+			 */
+			void record(const Response &response, MethodT method, std::chrono::steady_clock::duration duration);
+			void parse_error(const int code) {
+				parse_errors[static_cast<size_t>(code) < parse_error_codes ? code : 0].add();
+			}
+		};
+		/**
+		 * \brief Metrics of the calling thread. Blocks of exited threads are handed to new ones, their counts stay.
+		 */
+		ThreadMetrics &thread_metrics();
+	} // namespace detail
+
+	namespace metrics {
+		/**
+		 * \brief All metrics so far, summed over every thread, in the Prometheus text exposition format.
+		 */
+		std::string prometheus();
+	} // namespace metrics
+
+	namespace build {
+		// serves metrics::prometheus()
+		struct Metrics {
+			async operator()(Req request, Res response) const;
+		};
+	} // namespace build
+} // namespace ewhttp
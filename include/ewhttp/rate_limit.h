@@ -0,0 +1,45 @@
+#pragma once
+#include "./request.h"
+#include "./response.h"
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace ewhttp {
+	namespace build {
+		struct RateLimitOptions {
+			// requests per second each client may make on average, kept between one a day and a billion a second
+			double rate = 10;
+			// requests a client may make at once after being idle, at most 4095
+			unsigned int burst = 20;
+			// clients tracked at once, rounded up to a power of two. 8 bytes each, allocated up front.
+			size_t clients = 1 << 20;
+			// key on the last entry (the one the nearest proxy added) of this request header instead of the remote address, like "X-Forwarded-For". falls back to the address when it's missing.
+			std::string key_header{};
+		};
+	} // namespace build
+
+	namespace detail {
+		class RateLimiter; // rate_limit.cpp
+	}
+
+	namespace build {
+		/**
+		 * \brief Always handler that answers clients making requests faster than `rate` (after a `burst`) with a pre-serialized 429.
+		 * Every client has a token bucket in a fixed-size table, updated lock-free. When the table is full, the buckets idle the longest are reused.
+		 * Copies share the same table.
+		 */
+		struct RateLimit {
+			std::shared_ptr<detail::RateLimiter> limiter;
+
+			explicit RateLimit(const RateLimitOptions &options = {});
+			std::optional<async> check(Req request, Res response) const;
+			template<class... Parts>
+			std::optional<async> operator()(Req request, Res response, const Parts &...) const {
+				return check(request, response);
+			}
+		};
+	} // namespace build
+} // namespace ewhttp
@@ -1,8 +1,17 @@
 #pragma once
+#include "./detail/header_list.h"
+#include "./detail/url.h"
 #include "./method.h"
 
+#include <array>
 #include <asio.hpp>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <memory_resource>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <vector>
 
 namespace ewhttp {
@@ -14,22 +23,201 @@ namespace ewhttp {
 
 	class Server;
 	struct Response;
+
+	// request headers that Request finds without searching, see Request::header
+	enum class KnownHeader : uint8_t {
+		accept,
+		accept_encoding,
+		authorization,
+		connection,
+		content_length,
+		content_type,
+		cookie,
+		host,
+		if_modified_since,
+		if_none_match,
+		if_range,
+		range,
+		sec_websocket_key,
+		sec_websocket_version,
+		transfer_encoding,
+		upgrade,
+		user_agent,
+		x_forwarded_for,
+	};
+
+	namespace websocket {
+		class Session; // websocket.h
+	}
 	namespace detail {
 		struct RequestContext; // server.h
-	}
+
+		constexpr std::array<std::string_view, 18> known_header_names{
+				"Accept",
+				"Accept-Encoding",
+				"Authorization",
+				"Connection",
+				"Content-Length",
+				"Content-Type",
+				"Cookie",
+				"Host",
+				"If-Modified-Since",
+				"If-None-Match",
+				"If-Range",
+				"Range",
+				"Sec-WebSocket-Key",
+				"Sec-WebSocket-Version",
+				"Transfer-Encoding",
+				"Upgrade",
+				"User-Agent",
+				"X-Forwarded-For",
+		};
+		/**
+		 * \brief Which KnownHeader `name` is, case-insensitively.
+		 * \return Its index, or known_header_names.size() if it isn't one
+		 */
+		constexpr size_t known_header(const std::string_view name) {
+			for (size_t i = 0; i < known_header_names.size(); i++)
+				if (iequals(known_header_names[i], name))
+					return i;
+			return known_header_names.size();
+		}
+
+		// a block of a connection's incoming bytes. requests keep the block they were parsed from alive, so their views stay valid.
+		struct ReadBuffer {
+			std::vector<char> data;
+			size_t used = 0;
+
+			explicit ReadBuffer(const size_t size) : data(size) {}
+			bool contains(const char *ptr) const {
+				return ptr >= data.data() && ptr < data.data() + data.size();
+			}
+		};
+
+		// memory for one request, released all at once when the request is done. pooled per connection.
+		struct Arena {
+			alignas(std::max_align_t) std::array<std::byte, 4 * 1024> initial;
+			std::pmr::monotonic_buffer_resource resource{initial.data(), initial.size()};
+		};
+		// gives an arena back to its connection
+		struct ArenaReturn {
+			RequestContext *context;
+			void operator()(Arena *arena) const;
+		};
+	} // namespace detail
 	struct Request {
+	private:
+		// first, so it's destroyed last. the members below allocate from it.
+		std::unique_ptr<detail::Arena, detail::ArenaReturn> arena;
+
+	public:
 		MethodT method;
-		std::vector<std::pair<std::string, std::string>> headers{};
-		std::string path{};
+		// views into the connection's read buffer, valid for as long as this Request is
+		std::pmr::vector<std::pair<std::string_view, std::string_view>> headers;
+		// the target up to the query, as sent (still percent-encoded)
+		std::string_view path{};
+		// the target after the '?', as sent. empty if there was none.
+		std::string_view query{};
+
+		Request(Request &&) = default;
+		// not defaulted, the containers have to move along with the arena they're in
+		Request &operator=(Request &&other) noexcept;
+
+		/**
+		 * @brief Memory that lives as long as this request, for handler temporaries (`std::pmr::string s{request.memory()};`). Freed all at once when the request is done.
+		 */
+		std::pmr::memory_resource *memory() const { return &arena->resource; }
+
+		/**
+		 * @brief Waits for the next piece of the request body. The parser doesn't continue until the next call, so only one chunk is held in memory at a time.
+		 * @return The chunk, valid until the next call. std::nullopt once the body is complete.
+		 */
+		awaitopt<std::string_view> read_chunk();
+		/**
+		 * @brief Collects the entire request body. Only copies if the body didn't arrive contiguously, and then into one buffer sized by Content-Length when there is one.
+		 * @param max_size Maximum body size to accept
+		 * @return The body, valid as long as this Request. std::nullopt if the body is larger than max_size (the rest of it is skipped).
+		 */
+		awaitopt<std::string_view> read_body(size_t max_size);
+		/**
+		 * @brief The value of a header, the first one if it was sent more than once.
+		 * @param name Header name, compared case-insensitively. Well-known names are found without searching.
+		 * @return The value, or std::nullopt if the header wasn't sent
+		 */
+		std::optional<std::string_view> header(std::string_view name) const {
+			if (const auto known = detail::known_header(name); known < known_header_slots.size())
+				return header(static_cast<KnownHeader>(known));
+			return find_header(name);
+		}
+		std::optional<std::string_view> header(const KnownHeader name) const {
+			const auto slot = known_header_slots[static_cast<size_t>(name)];
+			if (slot == 0) return std::nullopt;
+			return headers[slot - 1].second;
+		}
+		/**
+		 * @brief Every value of a header, in the order they were sent.
+		 * @param name Header name, compared case-insensitively
+		 * @return The values, in this request's memory
+		 */
+		std::pmr::vector<std::string_view> header_values(std::string_view name) const;
+		/**
+		 * @brief The parameters in the query string, decoded. Parsed on the first call.
+		 * @return Names and values in the order they were sent, valid as long as this Request
+		 */
+		const std::pmr::vector<std::pair<std::string_view, std::string_view>> &query_params() const;
+		/**
+		 * @brief The decoded value of a query parameter, the first one if it was sent more than once. A parameter without '=' has an empty value.
+		 * @return The value, or std::nullopt if it wasn't sent
+		 */
+		std::optional<std::string_view> query_param(std::string_view name) const;
+		/**
+		 * @brief The cookies from the Cookie header, decoded. Parsed on the first call.
+		 * @return Names and values in the order they were sent, valid as long as this Request
+		 */
+		const std::pmr::vector<std::pair<std::string_view, std::string_view>> &cookies() const;
+		/**
+		 * @brief The decoded value of a cookie, the first one if it was sent more than once.
+		 * @return The value, or std::nullopt if it wasn't sent
+		 */
+		std::optional<std::string_view> cookie(std::string_view name) const;
+		/**
+		 * @brief The address of the client (or the proxy in front of it) this request came from.
+		 */
+		const asio::ip::address &remote_address() const;
 
 	private:
 		detail::RequestContext *context;
+		// position of this request on its connection
+		size_t sequence = 0;
+		std::shared_ptr<detail::ReadBuffer> buffer{};
+		// the block read_body's result is a view into, while it's still in one piece
+		std::shared_ptr<detail::ReadBuffer> body_buffer{};
+		// owned copies of values that didn't arrive contiguously in `buffer`. std::list so views into it survive moves.
+		std::pmr::list<std::pmr::string> spilled;
+		// 1 + the index in `headers` of the first of each KnownHeader, 0 if it wasn't sent
+		std::array<uint16_t, detail::known_header_names.size()> known_header_slots{};
+
+		// query_params() and cookies(), once they're asked for
+		mutable std::optional<std::pmr::vector<std::pair<std::string_view, std::string_view>>> parsed_query{}, parsed_cookies{};
+
+		std::optional<std::string_view> find_header(std::string_view name) const;
+		// give the header whose name was just parsed its KnownHeader slot, if it has one
+		void index_header() {
+			const auto known = detail::known_header(headers.back().first);
+			if (known < known_header_slots.size() && known_header_slots[known] == 0)
+				known_header_slots[known] = static_cast<uint16_t>(headers.size());
+		}
 
-		Request(MethodT method, detail::RequestContext *context) : method{method}, context{context} {}
-		Request &operator=(const Request &) = default;
+		Request(MethodT method, detail::RequestContext *context);
+		/**
+		 * @brief Extend `target` with `data`, which was just parsed from `from`. Only copies if the two aren't contiguous in a buffer owned by this request.
+		 */
+		void append(std::string_view &target, std::string_view data, const std::shared_ptr<detail::ReadBuffer> &from);
 		friend class Server;
 		friend struct Response;
+		friend struct detail::RequestContext;
+		friend class websocket::Session;
 	};
 
 	using Req = Request &;
-} // namespace ewhttp
\ No newline at end of file
+} // namespace ewhttp
@@ -1,16 +1,87 @@
 #pragma once
-#include "./detail/string_map.h"
+#include "./detail/header_list.h"
 #include "./method.h"
 #include "./request.h"
 #include "./status.h"
+#include <cstdint>
+#include <filesystem>
+#ifndef __linux__
+#include <fstream>
+#endif
+#include <initializer_list>
 #include <span>
+#include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 namespace ewhttp {
+	namespace build {
+		struct Files; // files.h
+	}
+	namespace websocket {
+		class Session; // websocket.h
+	}
+	namespace detail {
+		struct RouteLabel; // metrics.h
+		struct CacheFill;  // cache.h
+		struct Admission;  // limit.h
+		class ConcurrencyLimiter;
+		class RateLimiter; // rate_limit.h
+
+		// a response held back while a cache entry is built from it, see Response::write
+		struct Capture {
+			std::string bytes{};
+			// past this many bytes the response can't be stored, so what was held back is sent and the rest passes through
+			size_t limit;
+			// that happened, there's nothing to store
+			bool released = false;
+		};
+
+		/**
+		 * @brief A file opened before a response commits to sending it, so failing to open it can still be answered properly. See Response::send_file.
+		 */
+		class OpenedFile {
+#ifdef __linux__
+			int fd = -1;
+#else
+			std::ifstream stream;
+#endif
+			friend struct ewhttp::Response;
+
+		public:
+			std::filesystem::path path;
+			// errno from opening it, 0 if it's open
+			int error = 0;
+			// its size once it was opened
+			uintmax_t size = 0;
+
+			explicit OpenedFile(std::filesystem::path path);
+			OpenedFile(const OpenedFile &) = delete;
+			~OpenedFile();
+			bool is_open() const { return error == 0; }
+		};
+	} // namespace detail
+	class BodyWriter;
+	class EventStream;
+
+	/**
+	 * @brief A set of headers serialized once, to be added to many responses without formatting them again.
+	 * Usually a `static const` next to the handler.
+	 */
+	struct HeaderBlock {
+		std::string serialized;
+		HeaderBlock(std::initializer_list<std::pair<std::string_view, std::string_view>> headers);
+	};
+
 	struct Response {
 		StatusT status{200};
 		bool headers_sent{}, body_sent{};
+		// the route that handled this, set by the router. latency metrics are grouped by it.
+		const detail::RouteLabel *route{};
+
+		Response(const Response &) = delete;
+		~Response();
 
 		/**
 		 * @brief Adds a header to the response. Does not clear existing headers or overwrite existing headers.
@@ -26,8 +97,9 @@ namespace ewhttp {
 		/**
 		 * @brief Get the header value(s) for a given key.
 		 * @param key Header key
+		 * @return Views into the response's headers, valid until they're changed. To change values, use set_header.
 		 */
-		std::vector<std::string> &get_header(std::string_view key);
+		std::vector<std::string_view> get_header(std::string_view key) const;
 		/**
 		 * @brief Removes all instances of a certain header from the response.
 		 * @param key Header key
@@ -41,6 +113,18 @@ namespace ewhttp {
 		 * @return true if a previously existing header was removed, false otherwise
 		 */
 		bool set_header(std::string_view key, std::string_view value);
+		/**
+		 * @brief Replaces all instances of a header with one line per value, in order.
+		 * @param key Header key
+		 * @param values Header values, may be views returned by get_header
+		 * @return true if a previously existing header was removed, false otherwise
+		 */
+		bool set_header(std::string_view key, std::span<const std::string_view> values);
+		/**
+		 * @brief Adds a pre-serialized set of headers to the response, copying the bytes as-is.
+		 * @param block Headers to add
+		 */
+		void add_headers(const HeaderBlock &block);
 
 
 		/**
@@ -68,15 +152,140 @@ namespace ewhttp {
 		 * @param body The stream to read from
 		 */
 		async send_body(std::istream &body);
+		/**
+		 * @brief Sends (part of) a file as the body, with Content-Length. Uses sendfile(2) where available, so the data never passes through user space.
+		 * The file is opened before anything is sent, so if that fails (std::system_error) the response can still be answered differently.
+		 * @param path The file to send
+		 * @param offset Where in the file to start
+		 * @param length Amount of bytes to send
+		 */
+		async send_file(const std::filesystem::path &path, uintmax_t offset, uintmax_t length);
+		/**
+		 * @brief Starts a body of unknown length, written piece by piece through the returned writer. Uses chunked encoding unless a Content-Length was set.
+		 * @param buffer_size Writes are collected until this many bytes are waiting, then sent as one chunk
+		 */
+		BodyWriter stream(size_t buffer_size = 16 * 1024);
+		/**
+		 * @brief Starts a Server-Sent Events (text/event-stream) body. See EventStream.
+		 * @param buffer_size Events are collected until this many bytes are waiting, then sent as one chunk
+		 */
+		EventStream event_stream(size_t buffer_size = 16 * 1024);
 
 	private:
 		detail::RequestContext &context;
-		detail::string_map<std::vector<std::string>> headers{};
+		detail::HeaderList headers{};
+		// position of the request on its connection, responses are written in this order
+		size_t sequence;
+
+		// HEAD request: headers (with the Content-Length the body would have) are sent, the body isn't
+		bool omit_body{};
+		// a BodyWriter was started and not finished. if the handler returns like that, the body can't be ended properly and the connection is closed.
+		bool writer_open{};
+
+		// set while a cache entry is being built: everything written is collected here instead of being sent, up to its limit
+		detail::Capture *capture{};
+
+		// concurrency limiter slots this request holds, given back when the response is done
+		detail::Admission *admissions{};
+
+		// room for a status line that isn't in detail::status_lines
+		std::array<char, 24> custom_status_line;
+
+		/**
+		 * @brief Status line, header lines and the terminating CRLF, as buffers over this response's storage.
+		 */
+		std::array<asio::const_buffer, 3> serialize_headers();
+		/**
+		 * @brief Writes all buffers to the socket in one gathered write, once it's this response's turn.
+		 */
+		async write(std::span<const asio::const_buffer> buffers);
+		/**
+		 * @brief Stops capturing: sends what was held back, everything after it is written directly.
+		 */
+		async release_capture();
+		/**
+		 * @brief send_file for a file that's already open, for build::Files which opens it before deciding on any headers.
+		 */
+		async send_file(detail::OpenedFile &file, uintmax_t offset, uintmax_t length);
+		/**
+		 * @brief Writes part of a file to the socket, after the headers were sent.
+		 */
+		async write_file(detail::OpenedFile &file, uintmax_t offset, uintmax_t length);
+		/**
+		 * @brief Gives back the concurrency limiter slots and samples their latency. Done as soon as the handler is finished, not when the response is destroyed.
+		 */
+		void release_admissions();
 
-		explicit Response(Request &request) : context{*request.context} {}
-		explicit Response(detail::RequestContext &context) : context{context} {}
+		explicit Response(detail::RequestContext &context, const size_t sequence) : context{context}, sequence{sequence} {}
 		friend struct Request;
 		friend class Server;
+		friend struct build::Files;
+		friend class BodyWriter;
+		friend struct detail::CacheFill;
+		friend class detail::ConcurrencyLimiter;
+		friend class detail::RateLimiter;
+		friend class websocket::Session;
+	};
+
+	/**
+	 * @brief Writes a response body in pieces, see Response::stream().
+	 * Small writes are copied into a buffer and sent together, larger ones go out as they are. Every write to the socket is awaited,
+	 * so a slow client slows down the handler instead of piling up memory. finish() has to be called to end the body.
+	 */
+	class BodyWriter {
+		Response &response;
+		std::string pending{};
+		size_t buffer_size;
+		bool chunked;
+
+		// headers (first time), `data` as one chunk and, if `last`, the terminating chunk, in one write
+		async send(std::string_view data, bool last);
+
+		BodyWriter(Response &response, const size_t buffer_size, const bool chunked) : response{response}, buffer_size{buffer_size}, chunked{chunked} {}
+		friend struct Response;
+		friend class EventStream;
+
+	public:
+		BodyWriter(BodyWriter &&) = default;
+		/**
+		 * @brief Adds data to the body. Only waits for the socket once the buffer is full.
+		 * @param data Not used after this completes
+		 */
+		async write(std::span<const char> data);
+		/**
+		 * @brief Sends everything buffered so far (and the headers, if they weren't sent yet) and waits until the socket took it.
+		 */
+		async flush();
+		/**
+		 * @brief Sends what's left and ends the body. The writer can't be used anymore afterwards.
+		 */
+		async finish();
+	};
+
+	/**
+	 * @brief Writes Server-Sent Events, see Response::event_stream().
+	 * Events are buffered like BodyWriter writes, call flush() once the events available right now are sent to deliver them.
+	 */
+	class EventStream {
+		BodyWriter body;
+
+		explicit EventStream(BodyWriter &&body) : body{std::move(body)} {}
+		friend struct Response;
+
+	public:
+		/**
+		 * @brief Adds an event. `data` may contain line breaks, every line becomes its own data field.
+		 * @param data Event data
+		 * @param event Event type, left out if empty
+		 * @param id Event id, left out if empty
+		 */
+		async send(std::string_view data, std::string_view event = {}, std::string_view id = {});
+		/**
+		 * @brief Adds a comment line, which clients ignore. Useful as keep-alive through proxies that close idle connections.
+		 */
+		async comment(std::string_view text);
+		async flush() { return body.flush(); }
+		async finish() { return body.finish(); }
 	};
 
 	using Res = Response &;
@@ -1,11 +1,20 @@
 #pragma once
+#include "./cache.h"
+#include "./detail/method_table.h"
+#include "./detail/name_table.h"
 #include "./files.h"
+#include "./limit.h"
+#include "./metrics.h"
+#include "./rate_limit.h"
 #include "./request.h"
 #include "./response.h"
+#include "./websocket.h"
 
+#include <array>
 #include <asio/awaitable.hpp>
 #include <concepts>
 #include <optional>
+#include <string>
 #include <string_view>
 #include <tuple>
 #include <type_traits>
@@ -239,6 +248,28 @@ namespace ewhttp {
 			Fallback<Files> files(std::string_view path_to_root, const FilesOptions &options = {}) const {
 				return Fallback<Files>{Files{path_to_root, options}};
 			}
+			// GET handler with all metrics in the Prometheus text format
+			constexpr Handler<Metrics> metrics() const {
+				return Handler<Metrics>{Method::GET, Metrics{}};
+			}
+			// GET handler that answers WebSocket handshakes and runs `handler(request, session, parts...)` on the session
+			template<class H>
+			constexpr Handler<WebSocket<H>> websocket(H handler, const ewhttp::websocket::Options &options = {}) const {
+				return Handler<WebSocket<H>>{Method::GET, WebSocket<H>{handler, options}};
+			}
+			// admission control for the routes next to and below it, see Limit
+			Always<Limit> limit(const LimitOptions &options = {}) const {
+				return Always<Limit>{Limit{options}};
+			}
+			// answers clients over `options.rate` requests per second with 429, for the routes next to and below it. see RateLimit
+			Always<RateLimit> rate_limit(const RateLimitOptions &options = {}) const {
+				return Always<RateLimit>{RateLimit{options}};
+			}
+			// handler whose responses are stored and replayed for `options.ttl`, use it like the handler itself: `GET(_.cache(handler))`
+			template<class H>
+			Cache<H> cache(H handler, const CacheOptions &options = {}) const {
+				return Cache<H>{handler, options};
+			}
 			template<class H>
 			constexpr Fallback<H> fallback(H handler) const {
 				return Fallback<H>{handler};
@@ -263,12 +294,48 @@ namespace ewhttp {
 			return std::declval<T>();
 		}
 		template<class T>
-		awaitable<T> to_awaitable(awaitable<T> awaitable) {
-			return awaitable;
+		async discard_result(awaitable<T> awaitable) {
+			co_await std::move(awaitable);
 		}
-		template<class T>
-		awaitable<T> to_awaitable(T awaitable) {
-			co_return awaitable;
+		/**
+		 * \brief Call a handler. Synchronous ones run to completion right here without any coroutine frame.
+		 * \return What is left to co_await, or std::nullopt if the handler already finished
+		 */
+		// a `mutable` handler gets a copy per call, which the frame keeps alive while it's awaited
+		template<class H, class... Parts>
+		async invoke_copy(H handler, Request &request, Response &response, Parts... parts) {
+			using R = std::invoke_result_t<H &, Request &, Response &, Parts &...>;
+			if constexpr (std::is_same_v<R, std::optional<async>>) {
+				if (auto pending = handler(request, response, parts...))
+					co_await std::move(*pending);
+			} else {
+				co_await handler(request, response, parts...);
+			}
+		}
+		template<class H, class... Args>
+			requires(!std::invocable<const H &, Args...>)
+		std::optional<async> invoke_handler(const H &handler, Args &&...args) {
+			using R = std::invoke_result_t<H &, Args...>;
+			if constexpr (std::is_same_v<R, async> || std::is_same_v<R, std::optional<async>> || is_awaitable<R>) {
+				return invoke_copy(handler, std::forward<Args>(args)...);
+			} else {
+				auto copy = handler;
+				copy(std::forward<Args>(args)...);
+				return std::nullopt;
+			}
+		}
+		template<class H, class... Args>
+		std::optional<async> invoke_handler(const H &handler, Args &&...args) {
+			using R = std::invoke_result_t<const H &, Args...>;
+			if constexpr (std::is_same_v<R, async> || std::is_same_v<R, std::optional<async>>) {
+				// std::optional<async>: std::nullopt when it finished without having to wait
+				return handler(std::forward<Args>(args)...);
+			} else if constexpr (is_awaitable<R>) {
+				return discard_result(handler(std::forward<Args>(args)...));
+			} else {
+				handler(std::forward<Args>(args)...);
+				return std::nullopt;
+			}
 		}
 
 
@@ -318,24 +385,6 @@ namespace ewhttp {
 		template<class Tuple, class Parts>
 		concept handler_tuple = every<Tuple, []<class T>() consteval { return handler<T, Parts>; }>;
 
-		/**
-		 * \brief Iterate over a tuple.
-		 * \param tuple Tuple of elements to iterate over
-		 * \param callback Returns `true` to break, `false` to continue
-		 * \return `true` if callback broke, `false` if continued past the end
-		 */
-		template<class... Elements>
-		awaitable<bool> for_each_awaitable(const std::tuple<Elements...> tuple, auto callback) {
-			bool result = co_await std::apply([callback]<class... T>(T &&...element) -> awaitable<bool> {
-				bool done = false;
-				((done || ((done = co_await callback(element)))), ...);
-				co_return done;
-				// optimizer should convert a series of `if(!done)`s to early returns instead of constantly reevaluating the same condition. also these lambdas should all be inlined later.
-			},
-											  tuple);
-			co_return result;
-		}
-
 		/**
 		 * \brief Iterate over a tuple.
 		 * \param tuple Tuple of elements to iterate over
@@ -353,6 +402,30 @@ namespace ewhttp {
 							  tuple);
 		}
 
+		/**
+		 * \brief Call `callback.template operator()<I>()` with I == index, for a runtime index below N.
+		 * One jump through a table of N instantiations, however many there are.
+		 * \return What the callback returned
+		 */
+		template<size_t N, class F>
+		auto with_index(const size_t index, F &&callback) {
+			using Callback = std::remove_reference_t<F>;
+			// the result is returned as a prvalue, so awaitables (which can't be assigned) work too
+			using Result = decltype(callback.template operator()<0>());
+			static constexpr auto table = []<size_t... I>(std::index_sequence<I...>) {
+				return std::array<Result (*)(Callback &), N>{+[](Callback &target) -> Result { return target.template operator()<I>(); }...};
+			}(std::make_index_sequence<N>{});
+			return table[index](callback);
+		}
+
+		// "/" + "users" -> "/users", "/users" + ":param" -> "/users/:param"
+		constexpr std::string child_route(const std::string_view parent, const std::string_view part) {
+			std::string route{parent};
+			if (!route.ends_with('/')) route += '/';
+			route += part;
+			return route;
+		}
+
 		template<typename T>
 		concept first_path_parser = requires(T t) {
 			{ t.first } -> path_parser;
@@ -454,34 +527,84 @@ namespace ewhttp {
 		Named named;
 		Method method;
 		Fallback fallback;
-		constexpr Router(PathParser parser, PathParserNext parser_next, Always always, Named named, Method method, Fallback fallback) : parser{parser}, parser_next{parser_next}, always{always}, named{named}, method{method}, fallback{fallback} {}
+		static constexpr size_t named_count = std::tuple_size_v<Named>;
+		// path part -> index into `named`
+		detail::NameTable<named_count> named_table;
+		static constexpr size_t method_count = std::tuple_size_v<Method>;
+		// request method -> index into `method`
+		detail::MethodTable<method_count> method_table;
+		// for metrics, what responses from this level's method handlers and fallbacks are counted as
+		const detail::RouteLabel *route_label{}, *fallback_label{};
+		constexpr Router(PathParser parser, PathParserNext parser_next, Always always, Named named, Method method, Fallback fallback) : parser{parser}, parser_next{parser_next}, always{always}, named{named}, method{method}, fallback{fallback}, named_table{std::apply([](const auto &...named_router) { return std::array<std::string_view, named_count>{named_router.first...}; }, named)}, method_table{std::apply([](const auto &...method_handler) { return std::array<MethodT, method_count>{method_handler.first...}; }, method)} {}
 		template<class...>
 		friend constexpr auto create_router(build::router_c auto router);
 
+		// dispatch order: always handlers, method handlers, the named routes of the next path part, the path parser, fallbacks
+		static constexpr size_t always_count = std::tuple_size_v<Always>, fallback_count = std::tuple_size_v<Fallback>;
+		static constexpr size_t method_lookup_stage = always_count;
+		// method_stage + i runs method handler i
+		static constexpr size_t method_stage = method_lookup_stage + 1;
+		static constexpr size_t named_lookup_stage = method_stage + method_count;
+		// named_stage + i tries named route i
+		static constexpr size_t named_stage = named_lookup_stage + 1;
+		static constexpr size_t parser_stage = named_stage + named_count;
+		static constexpr size_t fallback_stage = parser_stage + 1;
+		static constexpr size_t end_stage = fallback_stage + fallback_count;
+
+		// continue routing from `stage` once `pending` is done
+		async resume(async pending, const size_t stage, Request &request, Response &response, const size_t path_progress, PreviouslyParsedParts... parts) const {
+			co_await std::move(pending);
+			if (response.body_sent) co_return; // replied, stop iterating and don't continue
+			if (auto rest = route(stage, request, response, path_progress, parts...))
+				co_await std::move(*rest);
+		}
+
+		// the path ends here but no handler takes the method: 405, or the answer to an OPTIONS request
+		async reply_allow(Response &response, const StatusT status) const {
+			response.status = status;
+			response.set_header("Allow", method_table.allow());
+			co_await response.send_body(std::span<const char>{});
+		}
+
+		// only reached with an awaitable path parser
+		async parse_async(Request &request, Response &response, const std::string_view path_part, const size_t postslash, PreviouslyParsedParts... parts) const {
+			if constexpr (path_parser_with_early<PathParser>) {
+				auto result = co_await parser(path_part, request, response);
+				if (!result.has_value()) co_return;
+				if (auto rest = parser_next.route(0, request, response, postslash, parts..., result.value()))
+					co_await std::move(*rest);
+			} else {
+				auto parsed = co_await parser(path_part);
+				if (auto rest = parser_next.route(0, request, response, postslash, parts..., parsed))
+					co_await std::move(*rest);
+			}
+		}
+		std::optional<async> parse(Request &request, Response &response, const std::string_view path_part, const size_t postslash, PreviouslyParsedParts... parts) const {
+			if constexpr (path_parser_with_early<PathParser>) {
+				if constexpr (detail::is_awaitable<std::invoke_result_t<const PathParser &, std::string_view, Request &, Response &>>) {
+					return parse_async(request, response, path_part, postslash, parts...);
+				} else {
+					auto result = parser(path_part, request, response);
+					if (!result.has_value()) return std::nullopt;
+					return parser_next.route(0, request, response, postslash, parts..., result.value());
+				}
+			} else {
+				if constexpr (detail::is_awaitable<std::invoke_result_t<const PathParser &, std::string_view>>)
+					return parse_async(request, response, path_part, postslash, parts...);
+				else
+					return parser_next.route(0, request, response, postslash, parts..., parser(path_part));
+			}
+		}
+
 	public:
-		// valid server callback
-		async operator()(Request &request, Response &response, const size_t path_progress = 1, PreviouslyParsedParts... parts) const {
-			if (co_await detail::for_each_awaitable(always, [&]<class A>(A &always_handler) -> awaitable<bool> {
-					if constexpr (std::is_void_v<std::invoke_result_t<A, Req, Res, PreviouslyParsedParts...>>) {
-						always_handler(request, response, parts...);
-					} else {
-						co_await detail::to_awaitable(always_handler(request, response, parts...));
-					}
-					co_return response.body_sent; // continue iterating
-				})) co_return;
+		/**
+		 * \brief Walk the routes starting at `stage`, running synchronous handlers right away.
+		 * Only allocates a coroutine frame once a handler actually has to be awaited.
+		 * \return What is left to co_await, or std::nullopt if routing already finished
+		 */
+		std::optional<async> route(size_t stage, Request &request, Response &response, const size_t path_progress, PreviouslyParsedParts... parts) const {
 			// reached the end of the url?
-			if (request.path.size() <= path_progress || (path_progress == request.path.size() - 1 && request.path.back() == '/')) {
-				// method handlers
-				if (co_await detail::for_each_awaitable(method, [&](auto &method_handler) -> awaitable<bool> {
-						if (method_handler.first == request.method) {
-							if constexpr (std::is_void_v<std::invoke_result_t<decltype(method_handler.second), Req, Res, PreviouslyParsedParts...>>) method_handler.second(request, response, parts...);
-							else
-								co_await detail::to_awaitable(method_handler.second(request, response, parts...));
-							co_return response.body_sent; // replied, stop iterating and don't continue
-						}
-						co_return false; // continue over method handlers
-					})) co_return;
-			}
+			const bool path_end = request.path.size() <= path_progress || (path_progress == request.path.size() - 1 && request.path.back() == '/');
 			std::string_view path_part{};
 			size_t postslash = request.path.size();
 			if (path_progress <= request.path.size()) {
@@ -491,43 +614,94 @@ namespace ewhttp {
 					postslash = preslash + 1;
 				path_part = std::string_view{request.path}.substr(path_progress, preslash - path_progress);
 			}
-			if (co_await detail::for_each_awaitable(named, [&](auto &named_handler) -> awaitable<bool> {
-					if (named_handler.first == path_part) {
-						co_await detail::to_awaitable(named_handler.second(request, response, postslash, parts...));
-						co_return response.body_sent; // replied, stop iterating and don't continue
-					}
-					co_return false; // continue iterating
-				})) co_return;
-			if constexpr (std::is_same_v<PathParser, std::nullopt_t>) {
-			} else if constexpr (path_parser_with_early<PathParser>) {
-				if (auto result = co_await detail::to_awaitable(parser(path_part, request, response)); result.has_value())
-					co_await parser_next(request, response, postslash, parts..., result.value());
-				if (response.body_sent) co_return;
-			} else {
-				co_await parser_next(request, response, postslash, parts..., co_await detail::to_awaitable(parser(path_part)));
-				if (response.body_sent) co_return;
-			}
 
-			co_await detail::for_each_awaitable(fallback, [&]<class F>(F fallback_handler) -> awaitable<bool> {
-				if constexpr (detail::HandlerVerifier<F, std::tuple<PreviouslyParsedParts...>>::subrouter) {
-					if constexpr (std::is_void_v<std::invoke_result_t<F, Req, Res, const size_t, PreviouslyParsedParts...>>)
-						fallback_handler(request, response, path_progress, parts...);
-					else
-						co_await detail::to_awaitable(fallback_handler(request, response, path_progress, parts...));
+			while (stage < end_stage) {
+				const size_t current = stage++;
+				if (current < method_lookup_stage) {
+					if constexpr (always_count > 0)
+						if (auto pending = detail::with_index<always_count>(current, [&]<size_t I>() {
+								return detail::invoke_handler(std::get<I>(always), request, response, parts...);
+							}))
+							return resume(std::move(*pending), stage, request, response, path_progress, parts...);
+				} else if (current == method_lookup_stage) {
+					if constexpr (method_count > 0) {
+						if (path_end) {
+							const auto index = method_table.find(request.method);
+							if (index != method_table.npos) {
+								stage = method_stage + index;
+							} else {
+								// the path matched, so don't fall through to the fallbacks (usually an expensive 404)
+								response.route = route_label;
+								return reply_allow(response, request.method == ewhttp::Method::OPTIONS ? Status::NoContent : Status::MethodNotAllowed);
+							}
+						} else {
+							stage = named_lookup_stage;
+						}
+					}
+					continue;
+				} else if (current < named_lookup_stage) {
+					if constexpr (method_count > 0) {
+						const auto index = current - method_stage;
+						// handlers for the same method are tried in order, then the named routes
+						const auto next = method_table.next(index);
+						stage = next == method_table.npos ? named_lookup_stage : method_stage + next;
+						response.route = route_label;
+						if (auto pending = detail::with_index<method_count>(index, [&]<size_t I>() {
+								return detail::invoke_handler(std::get<I>(method).second, request, response, parts...);
+							}))
+							return resume(std::move(*pending), stage, request, response, path_progress, parts...);
+					}
+				} else if (current == named_lookup_stage) {
+					if constexpr (named_count > 0) {
+						// one hash instead of comparing against every name
+						const auto index = named_table.find(path_part);
+						stage = index == named_table.npos ? parser_stage : named_stage + index;
+					}
+					continue;
+				} else if (current < parser_stage) {
+					if constexpr (named_count > 0) {
+						const auto index = current - named_stage;
+						// routes sharing a name are tried in order, then the parser
+						const auto next = named_table.next(index);
+						stage = next == named_table.npos ? parser_stage : named_stage + next;
+						if (auto pending = detail::with_index<named_count>(index, [&]<size_t I>() {
+								return std::get<I>(named).second.route(0, request, response, postslash, parts...);
+							}))
+							return resume(std::move(*pending), stage, request, response, path_progress, parts...);
+					}
+				} else if (current == parser_stage) {
+					if constexpr (!std::is_same_v<PathParser, std::nullopt_t>)
+						if (auto pending = parse(request, response, path_part, postslash, parts...))
+							return resume(std::move(*pending), stage, request, response, path_progress, parts...);
 				} else {
-					if constexpr (std::is_void_v<std::invoke_result_t<F, Req, Res, PreviouslyParsedParts...>>)
-						fallback_handler(request, response, parts...);
-					else
-						co_await detail::to_awaitable(fallback_handler(request, response, parts...));
+					response.route = fallback_label;
+					if constexpr (fallback_count > 0)
+						if (auto pending = detail::with_index<fallback_count>(current - fallback_stage, [&]<size_t I>() {
+								using F = std::tuple_element_t<I, Fallback>;
+								if constexpr (detail::HandlerVerifier<F, std::tuple<PreviouslyParsedParts...>>::subrouter)
+									return detail::invoke_handler(std::get<I>(fallback), request, response, path_progress, parts...);
+								else
+									return detail::invoke_handler(std::get<I>(fallback), request, response, parts...);
+							}))
+							return resume(std::move(*pending), stage, request, response, path_progress, parts...);
 				}
-				co_return response.body_sent;
-			});
-			co_return;
+				if (response.body_sent) return std::nullopt; // replied, stop iterating and don't continue
+			}
+			return std::nullopt;
+		}
+
+		// valid server callback
+		async operator()(Request &request, Response &response, const size_t path_progress = 1, PreviouslyParsedParts... parts) const {
+			if (auto pending = route(0, request, response, path_progress, parts...))
+				co_await std::move(*pending);
 		}
 	};
 
+	/**
+	 * \param route Pattern of the path leading here, for metrics
+	 */
 	template<class... PrevParsedParts>
-	constexpr auto create_router(build::router_c auto router) {
+	constexpr auto create_router(build::router_c auto router, const std::string_view route = "/") {
 		using router_t = decltype(router);
 		static_assert(routes<router_t, std::tuple<PrevParsedParts...>>);
 		using routes_type = typename router_t::routes_type;
@@ -537,7 +711,7 @@ namespace ewhttp {
 				// has a path parser alternative
 				auto parser_router = std::get<detail::IndexOf<EWHTTP_CONCEPT_LAMBDA(build::parser_c), routes_type>::value>(router.routes);
 				using pr_t = decltype(parser_router);
-				return std::make_pair(parser_router.parser, create_router<PrevParsedParts..., typename detail::PathParserReturn<typename pr_t::parser_type>::type>(parser_router.routes));
+				return std::make_pair(parser_router.parser, create_router<PrevParsedParts..., typename detail::PathParserReturn<typename pr_t::parser_type>::type>(parser_router.routes, detail::child_route(route, ":param")));
 			} else {
 				// no path parser alternative
 				return std::make_pair(std::nullopt, std::nullopt);
@@ -557,8 +731,8 @@ namespace ewhttp {
 		});
 		using fallback_t = decltype(fallback);
 		static_assert(detail::handler_tuple<fallback_t, std::tuple<PrevParsedParts...>>);
-		auto named = detail::filter_map<EWHTTP_CONCEPT_LAMBDA(build::name_c)>(router.routes, []<class... Routes>(build::Name<Routes...> pair) {
-			return std::make_pair(pair.name, create_router<PrevParsedParts...>(pair.routes));
+		auto named = detail::filter_map<EWHTTP_CONCEPT_LAMBDA(build::name_c)>(router.routes, [&]<class... Routes>(build::Name<Routes...> pair) {
+			return std::make_pair(pair.name, create_router<PrevParsedParts...>(pair.routes, detail::child_route(route, pair.name)));
 		});
 		using named_t = decltype(named);
 		static_assert(detail::named_router_tuple<named_t, PrevParsedParts...>);
@@ -568,7 +742,12 @@ namespace ewhttp {
 		using method_t = decltype(method);
 		static_assert(detail::method_handler_tuple<method_t, std::tuple<PrevParsedParts...>>);
 
-		return Router<parser_t, parsed_router_t, always_t, named_t, method_t, fallback_t, PrevParsedParts...>(parser, parsed_router, always, named, method, fallback);
+		Router<parser_t, parsed_router_t, always_t, named_t, method_t, fallback_t, PrevParsedParts...> result(parser, parsed_router, always, named, method, fallback);
+		if !consteval {
+			result.route_label = detail::intern_route(route);
+			result.fallback_label = detail::intern_route(detail::child_route(route, "*"));
+		}
+		return result;
 	}
 	template<class... PrevParsedParts>
 	constexpr auto create_router(build::route_c auto... routes) {
@@ -1,19 +1,154 @@
 #pragma once
+#include "./metrics.h"
 #include "./request.h"
 #include "./response.h"
 #include <asio.hpp>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
 
 namespace ewhttp {
 	using server_callback = std::function<async(Request &, Response &)>;
 
+	// what asio does its socket I/O with. io_uring with the EWHTTP_IO_URING CMake option.
+#if defined(ASIO_HAS_IO_URING_AS_DEFAULT)
+	constexpr std::string_view io_backend = "io_uring";
+#elif defined(ASIO_HAS_EPOLL)
+	constexpr std::string_view io_backend = "epoll";
+#elif defined(ASIO_HAS_KQUEUE)
+	constexpr std::string_view io_backend = "kqueue";
+#elif defined(ASIO_HAS_IOCP)
+	constexpr std::string_view io_backend = "iocp";
+#else
+	constexpr std::string_view io_backend = "select";
+#endif
+
+	struct ServerOptions {
+		// how many pipelined requests of one connection may be handled at once. responses are always sent in request order.
+		size_t max_pipelined = 16;
+
+		// how long a connection may wait for its next request. not counted while a response is still being worked on.
+		std::chrono::milliseconds idle_timeout = std::chrono::seconds{60};
+		// how long a client may take to send a request line and headers, in total. 408 once exceeded.
+		std::chrono::milliseconds header_timeout = std::chrono::seconds{10};
+		// how long a client may go without sending any of a body that's being read
+		std::chrono::milliseconds body_timeout = std::chrono::seconds{30};
+		// bytes of header names and values per request, 431 once exceeded
+		size_t max_header_bytes = 16 * 1024;
+		// headers per request, 431 once exceeded
+		size_t max_headers = 100;
+		// 414 once exceeded
+		size_t max_url_length = 8 * 1024;
+		// 413 if the Content-Length is larger. 0 for no limit.
+		size_t max_body_bytes = 0;
+		// open connections over all threads. new connections wait in the listen backlog until there's room. 0 for no limit.
+		size_t max_connections = 10000;
+		// closed connections whose buffers are kept around for new ones, per thread
+		size_t pooled_connections = 256;
+		// with more than one thread, pin each thread (including the one calling run) to its own core out of the ones this process may use. linux only.
+		bool pin_threads = false;
+	};
+
+	namespace detail {
+		struct RequestContext {
+			// requests take their arenas from here, and give them back when they're done
+			std::vector<std::unique_ptr<Arena>> free_arenas{};
+			Request request;
+			server_callback &callback;
+			std::string method{};
+			asio::ip::tcp::socket socket;
+			asio::any_io_executor executor;
+			// block currently being read into, and a previously used one to recycle once no request holds it anymore
+			std::shared_ptr<ReadBuffer> buffer, spare{};
+			// body of the request currently being parsed, handed to its handler chunk by chunk
+			struct {
+				enum { parsing, ready, taken } state = parsing; // ready: waiting for the handler, taken: handler holds `chunk`. parser is paused in both.
+				size_t sequence = 0;
+				std::string_view chunk{};
+				bool complete = false;
+				bool discard = false; // handler is done with it, drop the rest
+			} body{};
+			// pipelining: request n may only write once `responses_done == n`
+			size_t requests_started = 0, responses_done = 0;
+			size_t max_pipelined;
+			const ServerOptions &options;
+			// never expires, cancelled to wake up everything waiting in `wait()`
+			asio::steady_timer notifier;
+
+			// what the connection is waiting on the client for, decides how long a read may take
+			enum class Phase { idle, headers, body } phase = Phase::idle;
+			// expires when the current read takes too long, reused for every read
+			asio::steady_timer deadline;
+			// the request line and headers have to be complete by then
+			asio::steady_timer::time_point headers_deadline{};
+			size_t header_bytes = 0, body_bytes = 0;
+			bool watching = false;
+			// the request being parsed was refused with this status, sent once the responses before it are out
+			std::optional<StatusT> rejection{};
+			// the request just parsed asks to switch protocols. its handler may take the socket over (websocket::Session::accept), otherwise parsing continues once it's done.
+			struct {
+				bool requested = false; // set with its headers, before the handler starts
+				bool paused = false;    // the parser reached the end of it, `data` is known
+				bool accepted = false;
+				// bytes that came after the request, they belong to the new protocol
+				std::string_view data{};
+			} upgrade{};
+			// of the thread running this connection
+			ThreadMetrics *metrics;
+			// the client's address, looked up once when the connection opens
+			asio::ip::address remote{};
+
+			RequestContext(server_callback &callback, asio::ip::tcp::socket socket, asio::any_io_executor executor, const ServerOptions &options);
+			RequestContext(const RequestContext &) = delete;
+
+			/**
+			 * \brief Set up for a new connection, on the same shard. Keeps the allocated read buffers and arenas.
+			 */
+			void reuse(asio::ip::tcp::socket new_socket, asio::any_io_executor new_executor);
+			/**
+			 * \brief Forget the connection that just ended, so this can wait in its shard's pool.
+			 */
+			void release();
+
+			size_t in_flight() const { return requests_started - responses_done; }
+			/**
+			 * \brief Wait until `notify()` is called. Check your condition again afterwards.
+			 */
+			async wait();
+			void notify() { notifier.cancel(); }
+			/**
+			 * \brief Cancel reads that outlive `deadline`, until the connection closes.
+			 */
+			async watch_deadline();
+		};
+
+		// one io_context, acceptor and thread's worth of connections
+		struct Shard {
+			asio::io_context io_context{1};
+			asio::any_io_executor io_executor{};
+			std::optional<asio::ip::tcp::acceptor> acceptor{};
+			// state of closed connections, reused by the next ones
+			std::vector<std::unique_ptr<RequestContext>> free_contexts{};
+		};
+	} // namespace detail
+
 	class Server {
 		server_callback callback;
-		asio::io_context io_context{1};
-		asio::any_io_executor io_executor{};
+		ServerOptions options;
+		// shards[0] always exists and runs on the thread that calls run()
+		std::vector<std::unique_ptr<detail::Shard>> shards;
+		std::optional<asio::signal_set> signals{};
+		// open connections, checked against options.max_connections
+		std::atomic<size_t> connections{0};
 
 	public:
-		explicit Server(server_callback callback) : callback{std::move(callback)} {}
+		explicit Server(server_callback callback, const ServerOptions &options = {}) : callback{std::move(callback)}, options{options} {
+			shards.emplace_back(std::make_unique<detail::Shard>());
+		}
 		~Server() = default;
 
 		/**
@@ -28,6 +163,20 @@ namespace ewhttp {
 		 * \param port The port number to listen on.
 		 */
 		void run(std::string_view host, uint16_t port);
+		/**
+		 * \brief Run the server on `threads` threads, each with its own io_context and (where SO_REUSEPORT is available) its own acceptor. Connections stay on the thread that accepted them. Blocks until the server is stopped.
+		 * \param host The host to listen on.
+		 * \param port The port number to listen on.
+		 * \param threads Amount of threads to run on, including the calling thread. Often `std::thread::hardware_concurrency()`.
+		 */
+		void run(const asio::ip::address host, uint16_t port, unsigned int threads);
+		/**
+		 * \brief Run the server on `threads` threads. Blocks until the server is stopped.
+		 * \param host Must be an IP string.
+		 * \param port The port number to listen on.
+		 * \param threads Amount of threads to run on, including the calling thread.
+		 */
+		void run(std::string_view host, uint16_t port, unsigned int threads);
 		/**
 		 * \brief Rudely kill the server, not allowing it to finish operations.
 		 */
@@ -46,8 +195,8 @@ namespace ewhttp {
 		template<std::same_as<int>... S>
 			requires(sizeof...(S) > 0)
 		void stop_on(const bool force, S... stop_signals) {
-			asio::signal_set signals(io_context, stop_signals...);
-			signals.async_wait([&](auto...) {
+			signals.emplace(shards.front()->io_context, stop_signals...);
+			signals->async_wait([this, force](auto...) {
 				if (force)
 					force_stop();
 				else
@@ -66,18 +215,11 @@ namespace ewhttp {
 		}
 
 	private:
-		async respond(asio::ip::tcp::socket);
+		async respond(detail::Shard &shard, asio::ip::tcp::socket socket);
+		/**
+		 * \brief Accept connections on `shard`'s acceptor.
+		 * \param distribute If true, hand accepted connections to all shards round-robin instead of keeping them on `shard`. Used when the platform can't share a port between acceptors.
+		 */
+		async accept(detail::Shard &shard, bool distribute);
 	};
-
-	namespace detail {
-		struct RequestContext {
-			Request request;
-			server_callback &callback;
-			std::string method{};
-			asio::ip::tcp::socket socket;
-			asio::any_io_executor &executor;
-
-			RequestContext(const Request &request, server_callback &callback, std::string method, asio::ip::tcp::socket socket, asio::any_io_executor &executor) : request{request}, callback{callback}, method{std::move(method)}, socket{std::move(socket)}, executor{executor} {}
-		};
-	} // namespace detail
 } // namespace ewhttp
@@ -88,6 +88,59 @@ namespace ewhttp {
 			}
 		}
 	};
+	namespace detail {
+		constexpr std::uint_fast16_t first_status = 100, last_status = 599;
+		constexpr std::string_view status_line_prefix = "HTTP/1.1 ";
+
+		constexpr size_t status_line_size(const std::uint_fast16_t code) {
+			const auto name = StatusT{code}.name();
+			// "HTTP/1.1 200 OK\r\n"
+			return name.empty() ? 0 : status_line_prefix.size() + 4 + name.size() + 2;
+		}
+		constexpr size_t status_lines_size = [] {
+			size_t total = 0;
+			for (auto code = first_status; code <= last_status; code++)
+				total += status_line_size(code);
+			return total;
+		}();
+		// every known status line back to back, and where each one starts (indexed by code - first_status)
+		struct StatusLines {
+			std::array<char, status_lines_size> chars{};
+			std::array<std::uint16_t, last_status - first_status + 2> offsets{};
+		};
+		constexpr StatusLines status_lines = [] {
+			StatusLines lines{};
+			size_t pos = 0;
+			for (auto code = first_status; code <= last_status; code++) {
+				lines.offsets[code - first_status] = static_cast<std::uint16_t>(pos);
+				const auto name = StatusT{code}.name();
+				if (name.empty()) continue;
+				for (const char c : status_line_prefix) lines.chars[pos++] = c;
+				lines.chars[pos++] = static_cast<char>('0' + code / 100);
+				lines.chars[pos++] = static_cast<char>('0' + code / 10 % 10);
+				lines.chars[pos++] = static_cast<char>('0' + code % 10);
+				lines.chars[pos++] = ' ';
+				for (const char c : name) lines.chars[pos++] = c;
+				lines.chars[pos++] = '\r';
+				lines.chars[pos++] = '\n';
+			}
+			lines.offsets[last_status - first_status + 1] = static_cast<std::uint16_t>(pos);
+			return lines;
+		}();
+
+		/**
+		 * \brief Get the full status line ("HTTP/1.1 200 OK\r\n") for a status.
+		 * \return A view into a static table, or an empty view if the status has no known name.
+		 */
+		constexpr std::string_view status_line(const StatusT status) {
+			if (status.code < first_status || status.code > last_status)
+				return {};
+			const auto index = status.code - first_status;
+			const size_t begin = status_lines.offsets[index], end = status_lines.offsets[index + 1];
+			return std::string_view{status_lines.chars.data() + begin, end - begin};
+		}
+		static_assert(status_line(200) == "HTTP/1.1 200 OK\r\n");
+	} // namespace detail
 	namespace Status {
 		constexpr StatusT
 				Continue{100},
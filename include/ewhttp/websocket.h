@@ -0,0 +1,178 @@
+#pragma once
+#include "./request.h"
+#include "./response.h"
+
+#include <array>
+#include <asio.hpp>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ewhttp {
+	namespace websocket {
+		enum class Opcode : uint8_t {
+			continuation = 0x0,
+			text = 0x1,
+			binary = 0x2,
+			close = 0x8,
+			ping = 0x9,
+			pong = 0xA,
+		};
+
+		// close codes, RFC 6455 section 7.4.1
+		namespace close_code {
+			constexpr uint16_t normal = 1000;
+			constexpr uint16_t going_away = 1001;
+			constexpr uint16_t protocol_error = 1002;
+			constexpr uint16_t invalid_payload = 1007;
+			constexpr uint16_t too_big = 1009;
+		} // namespace close_code
+
+		struct Options {
+			// messages (after joining fragments) larger than this close the connection with close_code::too_big
+			size_t max_message_size = 16 * 1024 * 1024;
+			// a ping is sent this often, and the connection closed if nothing arrived since the previous one. 0 to turn off.
+			std::chrono::milliseconds ping_interval = std::chrono::seconds{30};
+		};
+
+		struct Message {
+			// text or binary, of the first fragment
+			Opcode opcode;
+			// unmasked in the session's read buffer, valid until the next receive()
+			std::string_view data;
+		};
+
+		/**
+		 * \brief A frame serialized once, to be sent to any amount of sessions without copying it for every one.
+		 */
+		class Frame {
+			struct Encoded {
+				std::array<char, 10> header;
+				uint8_t header_size;
+				std::string payload;
+			};
+			std::shared_ptr<const Encoded> encoded;
+			friend class Session;
+
+		public:
+			Frame(Opcode opcode, std::string_view payload);
+		};
+
+		namespace detail {
+			// the 2-10 byte header of an unmasked (server to client) frame
+			struct FrameHeader {
+				std::array<char, 10> bytes;
+				uint8_t size;
+				FrameHeader(Opcode opcode, size_t payload_size, bool fin = true);
+			};
+			/**
+			 * \brief XOR a frame's payload with its 4 byte mask, in place. Works a 64 bit word at a time, which compilers widen to vector registers.
+			 */
+			void unmask(std::span<char> data, std::array<uint8_t, 4> mask);
+		} // namespace detail
+
+		/**
+		 * \brief A WebSocket connection, taken over from the HTTP connection it was upgraded from. See Session::accept.
+		 * receive() and send() are for the thread the session runs on (the one its handler runs on). broadcast() may be called from anywhere.
+		 */
+		class Session : public std::enable_shared_from_this<Session> {
+			struct Outgoing {
+				std::array<char, 10> header;
+				uint8_t header_size;
+				std::string_view payload;
+				// keeps `payload` alive, for frames that nobody waits on
+				std::shared_ptr<const void> owner;
+			};
+
+			asio::ip::tcp::socket socket;
+			Options options;
+			// incoming bytes are [begin, end). frames are parsed and unmasked in place.
+			std::vector<char> buffer;
+			size_t begin = 0, end = 0;
+			// bytes of the message that receive() returned last time, dropped on the next call
+			size_t returned = 0;
+			// frames waiting for the writer, and how many were ever queued and written, to tell senders when theirs is out
+			std::deque<Outgoing> outgoing{};
+			size_t queued = 0, written = 0;
+			bool writing = false, close_sent = false, received_since_ping = true;
+			// never expires, cancelled to wake up everything waiting in `wait()`
+			asio::steady_timer notifier;
+			asio::steady_timer ping_timer;
+
+			async wait();
+			void notify() { notifier.cancel(); }
+			// queue a frame, and start the writer if it isn't running. returns its position, it's out once `written` reaches it.
+			size_t enqueue(Outgoing frame);
+			static async write_queue(std::shared_ptr<Session> self);
+			// doesn't keep the session alive, it ends once nobody else holds it
+			static async keepalive(std::weak_ptr<Session> weak);
+			// read more bytes, first making room by dropping consumed bytes and the headers between fragments, then by growing. false once the connection is gone.
+			awaitable<bool> read_more(size_t &message_start, size_t message_size, size_t &position);
+
+		public:
+			Session(asio::ip::tcp::socket socket, const Options &options, std::string_view already_read);
+			Session(const Session &) = delete;
+
+			/**
+			 * \brief Answer a WebSocket handshake and take over the request's connection. Call it before sending anything else.
+			 * Requests that aren't a WebSocket upgrade get a 400 (or 426 for an unsupported version).
+			 * \return The session, or nullptr if the request wasn't a valid upgrade. `response` can't be used anymore either way.
+			 */
+			static awaitable<std::shared_ptr<Session>> accept(Req request, Res response, const Options &options = {});
+
+			/**
+			 * \brief Waits for the next complete message, joining fragments. Answers pings and closes while waiting.
+			 * Text messages that aren't valid UTF-8 close the connection with close_code::invalid_payload.
+			 * \return The message, valid until the next call. std::nullopt once the connection is closed.
+			 */
+			awaitopt<Message> receive();
+			/**
+			 * \brief Send a message. `payload` isn't copied, it has to stay valid until this completes.
+			 * \return false if the connection is closed.
+			 */
+			awaitable<bool> send(std::string_view payload, Opcode opcode = Opcode::text);
+			/**
+			 * \brief Send a frame that was serialized beforehand.
+			 * \return false if the connection is closed.
+			 */
+			awaitable<bool> send(const Frame &frame);
+			/**
+			 * \brief Queue `frame` on every session, without waiting for it to be written. Thread-safe, every session is written to on its own thread.
+			 */
+			static void broadcast(const Frame &frame, std::span<const std::shared_ptr<Session>> sessions);
+			/**
+			 * \brief Send a close frame (unless one was sent already) and close the connection. receive() returns std::nullopt from then on.
+			 */
+			async close(uint16_t code = close_code::normal, std::string_view reason = {});
+			bool is_open() const { return socket.is_open(); }
+		};
+	} // namespace websocket
+
+	namespace build {
+		/**
+		 * \brief GET handler that accepts WebSocket upgrades and runs `handler(request, session, parts...)` on them, closing the session once it returns.
+		 */
+		template<class H>
+		struct WebSocket {
+			H handler;
+			websocket::Options options;
+
+			template<class... Parts>
+				requires std::invocable<const H &, Request &, websocket::Session &, Parts...>
+			async operator()(Req request, Res response, Parts... parts) const {
+				const auto session = co_await websocket::Session::accept(request, response, options);
+				if (!session) co_return;
+				co_await handler(request, *session, parts...);
+				if (session->is_open())
+					co_await session->close(websocket::close_code::normal);
+			}
+		};
+	} // namespace build
+} // namespace ewhttp
@@ -0,0 +1,249 @@
+#include <ewhttp/cache.h>
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace ewhttp::detail {
+	namespace {
+		using steady_clock = std::chrono::steady_clock;
+
+		struct Entry {
+			// status line, headers and body, exactly as they were sent the first time
+			std::string bytes;
+			StatusT status;
+			steady_clock::time_point expires;
+		};
+
+		// cacheable by default, RFC 9110 section 15.1. minus 206, the Range header isn't part of the key.
+		bool cacheable_status(const StatusT status) {
+			switch (status.code) {
+				case 200:
+				case 203:
+				case 204:
+				case 300:
+				case 301:
+				case 308:
+				case 404:
+				case 405:
+				case 410:
+				case 414:
+				case 501:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		// whether a comma separated list like Cache-Control contains `directive`, with or without an argument
+		bool has_directive(std::string_view list, const std::string_view directive) {
+			while (!list.empty()) {
+				const auto comma = list.find(',');
+				auto item = list.substr(0, comma);
+				item = item.substr(0, item.find('='));
+				while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+				while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+				if (iequals(item, directive)) return true;
+				if (comma == std::string_view::npos) break;
+				list.remove_prefix(comma + 1);
+			}
+			return false;
+		}
+
+		bool cacheable(const Response &response) {
+			if (!response.headers_sent || !cacheable_status(response.status) || response.has_header("Set-Cookie"))
+				return false;
+			for (const auto value : response.get_header("Cache-Control"))
+				if (has_directive(value, "no-store") || has_directive(value, "private"))
+					return false;
+			return true;
+		}
+	} // namespace
+
+	struct CacheStore {
+		struct Stored {
+			std::shared_ptr<const Entry> entry;
+			std::list<std::string_view>::iterator used;
+		};
+		struct Shard {
+			std::mutex mutex;
+			std::unordered_map<std::string, Stored> entries{};
+			// most recently used first, views of the keys in `entries`
+			std::list<std::string_view> lru{};
+			size_t size = 0;
+			// keys that a request is building right now, with the timers of the requests waiting for it
+			std::unordered_map<std::string, std::vector<std::shared_ptr<asio::steady_timer>>> filling{};
+			// keys whose last response couldn't be stored, until when requests for them just run the handler instead of waiting on each other
+			std::unordered_map<std::string, steady_clock::time_point> uncacheable{};
+		};
+
+		build::CacheOptions options;
+		size_t shard_count, shard_size;
+		std::unique_ptr<Shard[]> shards;
+
+		explicit CacheStore(const build::CacheOptions &options)
+			: options{options}, shard_count{std::max<size_t>(options.shards, 1)}, shard_size{options.max_size / shard_count},
+			  shards{std::make_unique<Shard[]>(shard_count)} {}
+
+		Shard &shard(const std::string_view key) const { return shards[std::hash<std::string_view>{}(key) % shard_count]; }
+
+		// method id, path, query and the vary headers, separated by NULs (which can't be in any of them)
+		std::string key(const Request &request) const {
+			std::string key(1, static_cast<char>(request.method.id));
+			key += request.path;
+			key += '?';
+			key += request.query;
+			for (const auto &name : options.vary) {
+				key += '\0';
+				key += request.header(name).value_or(std::string_view{});
+			}
+			return key;
+		}
+
+		static void erase(Shard &shard, const std::unordered_map<std::string, Stored>::iterator it) {
+			shard.size -= it->second.entry->bytes.size();
+			shard.lru.erase(it->second.used);
+			shard.entries.erase(it);
+		}
+
+		// false if it's too large for a shard
+		bool insert(Shard &shard, const std::string &key, std::shared_ptr<const Entry> entry) const {
+			const auto size = entry->bytes.size();
+			if (size > shard_size) return false;
+			if (const auto it = shard.entries.find(key); it != shard.entries.end())
+				erase(shard, it);
+			while (shard.size + size > shard_size)
+				erase(shard, shard.entries.find(std::string{shard.lru.back()}));
+			const auto [it, inserted] = shard.entries.emplace(key, Stored{std::move(entry)});
+			shard.lru.push_front(it->first);
+			it->second.used = shard.lru.begin();
+			shard.size += size;
+			return true;
+		}
+
+		void mark_uncacheable(Shard &shard, const std::string &key) const {
+			const auto now = steady_clock::now();
+			// every distinct path could end up here, don't let it grow without bound
+			if (shard.uncacheable.size() >= max_uncacheable) {
+				std::erase_if(shard.uncacheable, [&](const auto &pair) { return pair.second <= now; });
+				if (shard.uncacheable.size() >= max_uncacheable)
+					shard.uncacheable.clear();
+			}
+			shard.uncacheable.insert_or_assign(key, now + options.ttl);
+		}
+		static constexpr size_t max_uncacheable = 4096;
+	};
+
+	struct CacheFill {
+		CacheStore &store;
+		CacheStore::Shard &shard;
+		std::string key;
+		Capture captured;
+		// not building an entry, just running the handler: the key is uncacheable, or waiting for it took too long
+		bool bypass = false;
+		bool stored = false;
+
+		static void capture(Response &response, Capture *to) { response.capture = to; }
+		static async write(Response &response, const std::string_view bytes) {
+			const std::array<asio::const_buffer, 1> buffers{asio::buffer(bytes.data(), bytes.size())};
+			co_await response.write(buffers);
+		}
+	};
+
+	void CacheFillEnd::operator()(CacheFill *fill) const {
+		if (fill->bypass) {
+			delete fill;
+			return;
+		}
+		std::vector<std::shared_ptr<asio::steady_timer>> waiting;
+		{
+			const std::lock_guard lock{fill->shard.mutex};
+			const auto it = fill->shard.filling.find(fill->key);
+			waiting = std::move(it->second);
+			fill->shard.filling.erase(it);
+			// (or it threw.) the waiters run the handler themselves instead of taking turns building what can't be stored.
+			if (!fill->stored)
+				fill->store.mark_uncacheable(fill->shard, fill->key);
+		}
+		// timers belong to the waiters' threads. one expired before the waiter got to it completes right away.
+		for (auto &timer : waiting)
+			asio::post(timer->get_executor(), [timer] { timer->expires_at(asio::steady_timer::time_point::min()); });
+		delete fill;
+	}
+
+	std::shared_ptr<CacheStore> make_cache_store(const build::CacheOptions &options) {
+		return std::make_shared<CacheStore>(options);
+	}
+
+	awaitable<CacheFillPtr> cache_lookup(CacheStore &store, Req request, Res response) {
+		const auto executor = co_await asio::this_coro::executor;
+		auto key = store.key(request);
+		auto &shard = store.shard(key);
+		const auto give_up = steady_clock::now() + store.options.max_wait;
+		for (;;) {
+			std::shared_ptr<const Entry> hit;
+			std::shared_ptr<asio::steady_timer> waiting;
+			CacheFillPtr fill;
+			{
+				const std::lock_guard lock{shard.mutex};
+				if (const auto it = shard.entries.find(key); it != shard.entries.end()) {
+					if (steady_clock::now() < it->second.entry->expires) {
+						hit = it->second.entry;
+						shard.lru.splice(shard.lru.begin(), shard.lru, it->second.used);
+					} else {
+						CacheStore::erase(shard, it);
+					}
+				}
+				if (!hit) {
+					const auto uncacheable = shard.uncacheable.find(key);
+					if (uncacheable != shard.uncacheable.end() && steady_clock::now() >= uncacheable->second)
+						shard.uncacheable.erase(uncacheable);
+					else if (uncacheable != shard.uncacheable.end())
+						fill.reset(new CacheFill{store, shard, std::move(key), {}, true});
+					if (!fill) {
+						if (const auto [it, inserted] = shard.filling.try_emplace(key); inserted) {
+							fill.reset(new CacheFill{store, shard, std::move(key), {.limit = store.options.max_entry_size}});
+						} else if (steady_clock::now() >= give_up) {
+							fill.reset(new CacheFill{store, shard, std::move(key), {}, true});
+						} else {
+							waiting = std::make_shared<asio::steady_timer>(executor, give_up);
+							it->second.push_back(waiting);
+						}
+					}
+				}
+			}
+			if (hit) {
+				response.status = hit->status;
+				co_await CacheFill::write(response, hit->bytes);
+				response.headers_sent = true;
+				response.body_sent = true;
+				co_return nullptr;
+			}
+			if (fill) {
+				if (!fill->bypass)
+					CacheFill::capture(response, &fill->captured);
+				co_return fill;
+			}
+			// look again once the request building it is done, or when it's time to stop waiting
+			asio::error_code ec;
+			co_await waiting->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+		}
+	}
+
+	async cache_store(CacheFillPtr fill, Res response) {
+		// sent directly, or too large and already passed through
+		if (fill->bypass || fill->captured.released)
+			co_return;
+		CacheFill::capture(response, nullptr);
+		auto &store = fill->store;
+		const auto entry = std::make_shared<Entry>(std::move(fill->captured.bytes), response.status, steady_clock::now() + store.options.ttl);
+		if (cacheable(response) && entry->bytes.size() <= store.options.max_entry_size) {
+			const std::lock_guard lock{fill->shard.mutex};
+			fill->stored = store.insert(fill->shard, fill->key, entry);
+		}
+		// the waiters can go ahead while this one is still writing
+		fill.reset();
+		co_await CacheFill::write(response, entry->bytes);
+	}
+} // namespace ewhttp::detail
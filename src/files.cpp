@@ -1,44 +1,816 @@
 #include <ewhttp/files.h>
+#include <ewhttp/server.h>
 
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstdio>
 #include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#ifdef EWHTTP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef EWHTTP_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef EWHTTP_WITH_ZSTD
+#include <zstd.h>
+#endif
 
 namespace ewhttp::build {
-	Files::Files(std::string_view path_to_root, const FilesOptions &options) {
-		for (const auto &member : std::filesystem::recursive_directory_iterator{path_to_root}) {
-			if (member.is_directory())
-				continue;
-			auto size = member.file_size();
-			const auto &path = member.path();
-			std::string path_string = path.generic_string();
-			std::string url_path = path_string.substr(path_to_root.size() + 1);
-			if (size < options.max_memory_cached) {
-				detail::MemoryFile file{};
-				file.data.reserve(size);
-				std::ifstream stream(path, std::ios::binary);
-				stream.unsetf(std::ios::skipws);
-				file.data.insert(file.data.begin(),
-								 std::istream_iterator<uint8_t>(stream),
-								 std::istream_iterator<uint8_t>());
-				files.emplace(url_path, file);
-			} else {
-				detail::StreamingFile file{path, size};
-				files.emplace(url_path, file);
+	namespace {
+		using std::chrono::sys_seconds;
+
+		constexpr std::array<std::string_view, 7> weekday_names{"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+		constexpr std::array<std::string_view, 12> month_names{"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+		// separates the parts of a multipart/byteranges body
+		constexpr std::string_view boundary = "ewhttp-byteranges-6b1f3e0d94a2c7";
+		// more ranges than this in one request and the whole file is sent instead
+		constexpr size_t max_ranges = 16;
+
+		// IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+		std::string http_date(const sys_seconds time) {
+			const auto days = std::chrono::floor<std::chrono::days>(time);
+			const std::chrono::year_month_day date{days};
+			const std::chrono::hh_mm_ss clock{time - days};
+			char buffer[32];
+			const int size = std::snprintf(buffer, sizeof(buffer), "%s, %02u %s %04d %02d:%02d:%02d GMT",
+										   weekday_names[std::chrono::weekday{days}.c_encoding()].data(),
+										   static_cast<unsigned>(date.day()),
+										   month_names[static_cast<unsigned>(date.month()) - 1].data(),
+										   static_cast<int>(date.year()),
+										   static_cast<int>(clock.hours().count()),
+										   static_cast<int>(clock.minutes().count()),
+										   static_cast<int>(clock.seconds().count()));
+			return std::string(buffer, size);
+		}
+
+		std::optional<sys_seconds> parse_http_date(const std::string_view str) {
+			// only IMF-fixdate, the obsolete formats aren't sent by anything that matters
+			if (str.size() != 29 || str.substr(25) != " GMT")
+				return std::nullopt;
+			const auto number = [&](const size_t pos, const size_t size) -> std::optional<int> {
+				int n;
+				if (const auto [ptr, ec] = std::from_chars(str.data() + pos, str.data() + pos + size, n); ec != std::errc{} || ptr != str.data() + pos + size)
+					return std::nullopt;
+				return n;
+			};
+			const auto month = std::ranges::find(month_names, str.substr(8, 3));
+			const auto day = number(5, 2), year = number(12, 4), hours = number(17, 2), minutes = number(20, 2), seconds = number(23, 2);
+			if (month == month_names.end() || !day || !year || !hours || !minutes || !seconds)
+				return std::nullopt;
+			const std::chrono::year_month_day date{std::chrono::year{*year}, std::chrono::month{static_cast<unsigned>(month - month_names.begin() + 1)}, std::chrono::day{static_cast<unsigned>(*day)}};
+			if (!date.ok())
+				return std::nullopt;
+			return std::chrono::sys_days{date} + std::chrono::hours{*hours} + std::chrono::minutes{*minutes} + std::chrono::seconds{*seconds};
+		}
+
+		// FNV-1a
+		uint64_t hash(const std::span<const uint8_t> data, uint64_t state = 14695981039346656037ull) {
+			for (const auto byte : data)
+				state = (state ^ byte) * 1099511628211ull;
+			return state;
+		}
+		std::string make_etag(const uint64_t hash) {
+			char buffer[19] = {'"'};
+			auto end = std::to_chars(buffer + 1, buffer + 18, hash, 16).ptr;
+			*end++ = '"';
+			return std::string(buffer, end);
+		}
+
+		std::string_view trim(std::string_view str) {
+			while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) str.remove_prefix(1);
+			while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) str.remove_suffix(1);
+			return str;
+		}
+
+		std::optional<std::string_view> find_header(const Request &request, const KnownHeader name) {
+			if (const auto value = request.header(name))
+				return trim(*value);
+			return std::nullopt;
+		}
+
+		// If-None-Match uses the weak comparison, W/ prefixes don't matter
+		bool etag_list_matches(std::string_view list, const std::string_view etag) {
+			while (!list.empty()) {
+				const auto comma = list.find(',');
+				auto tag = trim(list.substr(0, comma));
+				list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+				if (tag.starts_with("W/")) tag.remove_prefix(2);
+				if (tag == "*" || tag == etag)
+					return true;
+			}
+			return false;
+		}
+
+		bool not_modified(const Request &request, const detail::File &file, const std::string_view etag) {
+			if (request.method != Method::GET && request.method != Method::HEAD)
+				return false;
+			// If-None-Match takes precedence over If-Modified-Since
+			if (const auto tags = find_header(request, KnownHeader::if_none_match))
+				return etag_list_matches(*tags, etag);
+			if (const auto since = find_header(request, KnownHeader::if_modified_since))
+				if (const auto time = parse_http_date(*since))
+					return file.modified <= *time;
+			return false;
+		}
+
+		// Range only applies if If-Range (if present) still matches, otherwise the client's partial copy is outdated
+		bool if_range_matches(const Request &request, const detail::File &file, const std::string_view etag) {
+			const auto condition = find_header(request, KnownHeader::if_range);
+			if (!condition)
+				return true;
+			if (condition->starts_with('"'))
+				return *condition == etag; // strong comparison
+			if (condition->starts_with("W/"))
+				return false;
+			return *condition == file.last_modified;
+		}
+
+		struct ByteRange {
+			uintmax_t first, last; // inclusive
+			uintmax_t size() const { return last - first + 1; }
+		};
+		/**
+		 * \brief Parse a Range header.
+		 * \return std::nullopt if the header should be ignored (invalid or too many ranges), empty if nothing is satisfiable.
+		 */
+		std::optional<std::vector<ByteRange>> parse_ranges(std::string_view header, const uintmax_t size) {
+			if (!header.starts_with("bytes="))
+				return std::nullopt;
+			header.remove_prefix(6);
+			const auto number = [](const std::string_view str) -> std::optional<uintmax_t> {
+				uintmax_t n;
+				if (const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), n); ec != std::errc{} || ptr != str.data() + str.size())
+					return std::nullopt;
+				return n;
+			};
+			std::vector<ByteRange> ranges;
+			while (!header.empty()) {
+				const auto comma = header.find(',');
+				const auto spec = trim(header.substr(0, comma));
+				header = comma == std::string_view::npos ? std::string_view{} : header.substr(comma + 1);
+				if (spec.empty()) continue;
+				const auto dash = spec.find('-');
+				if (dash == std::string_view::npos)
+					return std::nullopt;
+				ByteRange range{};
+				if (dash == 0) {
+					// suffix, "-500" is the last 500 bytes
+					const auto suffix = number(spec.substr(1));
+					if (!suffix) return std::nullopt;
+					if (*suffix == 0 || size == 0) continue;
+					range = {*suffix >= size ? 0 : size - *suffix, size - 1};
+				} else {
+					const auto first = number(spec.substr(0, dash));
+					if (!first) return std::nullopt;
+					range.first = *first;
+					if (dash + 1 == spec.size()) {
+						range.last = size - 1;
+					} else {
+						const auto last = number(spec.substr(dash + 1));
+						if (!last || *last < *first) return std::nullopt;
+						range.last = std::min(*last, size - 1);
+					}
+					if (range.first >= size) continue;
+				}
+				ranges.push_back(range);
+				if (ranges.size() > max_ranges)
+					return std::nullopt;
+			}
+			return ranges;
+		}
+
+		/**
+		 * \brief Compress `data` for a Content-Encoding.
+		 * \return std::nullopt if ewhttp was built without support for the encoding, or compression failed.
+		 */
+		std::optional<std::vector<uint8_t>> compress(const detail::Encoding encoding, [[maybe_unused]] const std::span<const uint8_t> data, [[maybe_unused]] const FilesOptions &options) {
+			std::vector<uint8_t> out;
+			switch (encoding) {
+				case detail::Encoding::br: {
+#ifdef EWHTTP_WITH_BROTLI
+					size_t size = BrotliEncoderMaxCompressedSize(data.size());
+					if (size == 0)
+						return std::nullopt;
+					out.resize(size);
+					if (!BrotliEncoderCompress(std::clamp(options.brotli_quality, BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY), BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, data.size(), data.data(), &size, out.data()))
+						return std::nullopt;
+					out.resize(size);
+					return out;
+#else
+					return std::nullopt;
+#endif
+				}
+				case detail::Encoding::zstd: {
+#ifdef EWHTTP_WITH_ZSTD
+					out.resize(ZSTD_compressBound(data.size()));
+					const size_t size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), std::clamp(options.zstd_level, 1, ZSTD_maxCLevel()));
+					if (ZSTD_isError(size))
+						return std::nullopt;
+					out.resize(size);
+					return out;
+#else
+					return std::nullopt;
+#endif
+				}
+				case detail::Encoding::gzip: {
+#ifdef EWHTTP_WITH_ZLIB
+					if (data.size() > UINT_MAX)
+						return std::nullopt;
+					z_stream stream{};
+					// 15 + 16: maximum window, gzip wrapper instead of zlib
+					if (deflateInit2(&stream, std::clamp(options.gzip_level, Z_BEST_SPEED, Z_BEST_COMPRESSION), Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+						return std::nullopt;
+					out.resize(deflateBound(&stream, static_cast<uLong>(data.size())));
+					stream.next_in = const_cast<Bytef *>(data.data());
+					stream.avail_in = static_cast<uInt>(data.size());
+					stream.next_out = out.data();
+					stream.avail_out = static_cast<uInt>(out.size());
+					const int result = deflate(&stream, Z_FINISH);
+					out.resize(stream.total_out);
+					deflateEnd(&stream);
+					if (result != Z_STREAM_END)
+						return std::nullopt;
+					return out;
+#else
+					return std::nullopt;
+#endif
+				}
+			}
+			return std::nullopt;
+		}
+
+		// q-value of `coding` in an Accept-Encoding header, 0 if it's not acceptable
+		// quality of `coding` in an Accept-Encoding header, std::nullopt if it's neither listed nor covered by "*"
+		std::optional<float> accept_quality(std::string_view header, const std::string_view coding) {
+			std::optional<float> wildcard;
+			while (!header.empty()) {
+				const auto comma = header.find(',');
+				auto item = header.substr(0, comma);
+				header = comma == std::string_view::npos ? std::string_view{} : header.substr(comma + 1);
+				const auto semicolon = item.find(';');
+				const auto name = trim(item.substr(0, semicolon));
+				float quality = 1;
+				if (semicolon != std::string_view::npos) {
+					const auto parameter = trim(item.substr(semicolon + 1));
+					if (parameter.starts_with("q=") || parameter.starts_with("Q="))
+						std::from_chars(parameter.data() + 2, parameter.data() + parameter.size(), quality);
+				}
+				if (detail::iequals(name, coding))
+					return quality;
+				if (name == "*")
+					wildcard = quality;
+			}
+			return wildcard;
+		}
+
+		// identity is acceptable unless it's refused with "identity;q=0", or with "*;q=0" without identity listed
+		bool identity_refused(const Request &request) {
+			const auto header = find_header(request, KnownHeader::accept_encoding);
+			return header && accept_quality(*header, "identity").value_or(1) <= 0;
+		}
+
+		// the best acceptable precompressed variant, or nullptr for identity
+		const detail::EncodedFile *pick_encoding(const Request &request, const detail::File &file) {
+			if (file.encoded.empty())
+				return nullptr;
+			const auto header = find_header(request, KnownHeader::accept_encoding);
+			if (!header)
+				return nullptr;
+			const detail::EncodedFile *best = nullptr;
+			float best_quality = 0;
+			// `encoded` is sorted by preference, so ties go to the earlier one
+			for (const auto &encoded : file.encoded)
+				if (const auto quality = accept_quality(*header, detail::encoding_names[static_cast<size_t>(encoded.encoding)]).value_or(0); quality > best_quality) {
+					best = &encoded;
+					best_quality = quality;
+				}
+			return best;
+		}
+
+		std::string content_range(const ByteRange &range, const uintmax_t size) {
+			return "bytes " + std::to_string(range.first) + '-' + std::to_string(range.last) + '/' + std::to_string(size);
+		}
+	} // namespace
+
+	namespace {
+		bool is_precompressed(const std::string_view path) {
+			return std::ranges::any_of(detail::encoding_extensions, [&](const std::string_view extension) { return path.ends_with(extension); });
+		}
+
+		detail::MemoryFile read_file(const std::filesystem::path &path, const uintmax_t size) {
+			detail::MemoryFile memory{};
+			memory.data.reserve(size);
+			std::ifstream stream(path, std::ios::binary);
+			stream.unsetf(std::ios::skipws);
+			memory.data.insert(memory.data.begin(),
+							   std::istream_iterator<uint8_t>(stream),
+							   std::istream_iterator<uint8_t>());
+			return memory;
+		}
+
+		// contents and strong etag of one file on disk
+		std::pair<std::variant<detail::MemoryFile, detail::StreamingFile>, std::string> load_contents(const std::filesystem::path &path, const uintmax_t size, const sys_seconds modified, const bool in_memory) {
+			if (in_memory) {
+				auto memory = read_file(path, size);
+				auto etag = make_etag(hash(memory.data));
+				return {std::move(memory), std::move(etag)};
+			}
+			// hashing would mean reading the whole file
+			const std::array<uint64_t, 2> identity{size, static_cast<uint64_t>(modified.time_since_epoch().count())};
+			return {detail::StreamingFile{path, size}, make_etag(hash({reinterpret_cast<const uint8_t *>(identity.data()), sizeof(identity)}))};
+		}
+
+		sys_seconds modification_time(const std::filesystem::directory_entry &entry, std::error_code &ec) {
+			return std::chrono::floor<std::chrono::seconds>(std::chrono::file_clock::to_sys(entry.last_write_time(ec)));
+		}
+
+		// compress a file that's in memory, if that's supported and worth it. the etag is the identity one with the encoding added.
+		void add_compressed(detail::File &file, const detail::Encoding encoding, const FilesOptions &options) {
+			const auto &data = std::get<detail::MemoryFile>(file.contents).data;
+			if (!options.compress || file.size < options.min_compress_size)
+				return;
+			auto compressed = compress(encoding, data, options);
+			if (!compressed || compressed->size() >= file.size)
+				return;
+			auto variant_etag = file.etag;
+			variant_etag.insert(variant_etag.size() - 1, "-" + std::string{detail::encoding_names[static_cast<size_t>(encoding)]});
+			const auto compressed_size = compressed->size();
+			file.encoded.push_back({encoding, detail::MemoryFile{std::move(*compressed)}, compressed_size, std::move(variant_etag)});
+		}
+
+		/**
+		 * \brief Load a file and its compressed variants (sibling files, or compressed now if it's in memory).
+		 * \return The file, or nullptr if it disappeared or can't be read anymore
+		 */
+		std::shared_ptr<detail::File> load_file(const std::filesystem::directory_entry &entry, const bool in_memory, const FilesOptions &options) {
+			std::error_code ec;
+			const auto size = entry.file_size(ec);
+			if (ec) return nullptr;
+			const auto modified = modification_time(entry, ec);
+			if (ec) return nullptr;
+			auto [contents, etag] = load_contents(entry.path(), size, modified, in_memory);
+			auto file = std::make_shared<detail::File>(std::move(contents), size, std::move(etag), modified, http_date(modified));
+			if (is_precompressed(entry.path().native()))
+				return file;
+			const auto memory = std::get_if<detail::MemoryFile>(&file->contents);
+			for (size_t i = 0; i < detail::encoding_names.size(); i++) {
+				const auto encoding = static_cast<detail::Encoding>(i);
+				auto sibling_path = entry.path();
+				sibling_path += detail::encoding_extensions[i];
+				if (const std::filesystem::directory_entry sibling{sibling_path, ec}; !ec && sibling.is_regular_file(ec)) {
+					const auto sibling_size = sibling.file_size(ec);
+					if (ec) continue; // gone again
+					const auto sibling_modified = modification_time(sibling, ec);
+					if (ec) continue;
+					auto [sibling_contents, sibling_etag] = load_contents(sibling_path, sibling_size, sibling_modified, in_memory);
+					file->encoded.push_back({encoding, std::move(sibling_contents), sibling_size, std::move(sibling_etag)});
+				} else if (memory) {
+					add_compressed(*file, encoding, options);
+				}
 			}
+			return file;
 		}
+
+		/**
+		 * \brief Call `callback(entry)` for everything under `directory`. Whatever disappears while walking it is skipped instead of throwing.
+		 * \param ec Set if `directory` itself couldn't be opened
+		 */
+		void walk(const std::filesystem::path &directory, std::error_code &ec, const std::function<void(const std::filesystem::directory_entry &)> &callback) {
+			std::filesystem::recursive_directory_iterator it{directory, std::filesystem::directory_options::skip_permission_denied, ec};
+			for (std::error_code step; !ec && !step && it != std::filesystem::recursive_directory_iterator{}; it.increment(step))
+				callback(*it);
+		}
+
+		/**
+		 * \brief The same file, moved into or out of memory by rebalancing. The file on disk didn't change, so neither do its etags, dates or hits.
+		 * Sibling files are moved along, compressed copies are made when moving into memory and only kept when moving out if `keep_compressed`.
+		 */
+		std::shared_ptr<detail::File> change_tier(const detail::File &file, const std::filesystem::path &path, const bool in_memory, const bool keep_compressed, const FilesOptions &options) {
+			std::variant<detail::MemoryFile, detail::StreamingFile> contents = detail::StreamingFile{path, file.size};
+			if (in_memory)
+				contents = read_file(path, file.size);
+			auto moved = std::make_shared<detail::File>(std::move(contents), file.size, file.etag, file.modified, file.last_modified);
+			moved->hits.store(file.hits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			for (const auto &variant : file.encoded) {
+				auto sibling_path = path;
+				sibling_path += detail::encoding_extensions[static_cast<size_t>(variant.encoding)];
+				std::error_code ec;
+				if (std::filesystem::is_regular_file(sibling_path, ec)) {
+					std::variant<detail::MemoryFile, detail::StreamingFile> sibling = detail::StreamingFile{sibling_path, variant.size};
+					if (in_memory)
+						sibling = read_file(sibling_path, variant.size);
+					moved->encoded.push_back({variant.encoding, std::move(sibling), variant.size, variant.etag});
+				} else if (in_memory || keep_compressed) {
+					moved->encoded.push_back(variant);
+				}
+			}
+			if (in_memory && !is_precompressed(path.native()))
+				for (size_t i = 0; i < detail::encoding_names.size(); i++)
+					if (const auto encoding = static_cast<detail::Encoding>(i); std::ranges::none_of(moved->encoded, [&](const detail::EncodedFile &variant) { return variant.encoding == encoding; }))
+						add_compressed(*moved, encoding, options);
+			// preference order
+			std::ranges::sort(moved->encoded, {}, &detail::EncodedFile::encoding);
+			return moved;
+		}
+	} // namespace
+} // namespace ewhttp::build
+
+namespace ewhttp::detail {
+	uintmax_t File::memory_size() const {
+		uintmax_t total = 0;
+		if (const auto memory = std::get_if<MemoryFile>(&contents))
+			total += memory->data.size();
+		for (const auto &variant : encoded)
+			if (const auto memory = std::get_if<MemoryFile>(&variant.contents))
+				total += memory->data.size();
+		return total;
 	}
 
-	async Files::operator()(Req request, Res response, const size_t path_progress) {
+	struct FileStore {
+		std::filesystem::path root;
+		build::FilesOptions options;
+		mutable std::shared_mutex mutex;
+		string_map<std::shared_ptr<const File>> files;
+#ifdef __linux__
+		int inotify = -1;
+		std::unordered_map<int, std::filesystem::path> watches; // watch descriptor -> directory
+#endif
+		std::jthread worker; // last, so it stops before anything it uses is destroyed
+
+		FileStore(std::filesystem::path root_path, const build::FilesOptions &options_) : root{std::move(root_path)}, options{options_} {
+			uintmax_t memory_used = 0;
+			std::error_code ec;
+			build::walk(root, ec, [&](const std::filesystem::directory_entry &member) {
+				std::error_code member_ec;
+				if (member.is_directory(member_ec))
+					return;
+				const auto size = member.file_size(member_ec);
+				if (member_ec)
+					return;
+				const bool in_memory = size < options.max_memory_cached && (options.max_memory_total == 0 || memory_used + size <= options.max_memory_total);
+				auto file = build::load_file(member, in_memory, options);
+				// compressed copies count too
+				if (file && in_memory && options.max_memory_total != 0 && memory_used + file->memory_size() > options.max_memory_total)
+					file = build::load_file(member, false, options);
+				if (!file)
+					return;
+				memory_used += file->memory_size();
+				files.emplace(url_path(member.path()), std::move(file));
+			});
+			// a missing root is a mistake, not something that happened meanwhile
+			if (ec)
+				throw std::filesystem::filesystem_error("Error reading static files", root, ec);
+#ifdef __linux__
+			if (options.watch) {
+				inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+				if (inotify < 0)
+					throw std::system_error(errno, std::generic_category(), "inotify_init1");
+				watch_tree(root);
+			}
+			const bool watching = inotify >= 0;
+#else
+			const bool watching = false;
+#endif
+			if (watching || options.max_memory_total != 0)
+				worker = std::jthread{[this](const std::stop_token &stop) { run(stop); }};
+		}
+		~FileStore() {
+			worker = {}; // request stop and join
+#ifdef __linux__
+			if (inotify >= 0) close(inotify);
+#endif
+		}
+
+		std::string url_path(const std::filesystem::path &path) const {
+			return path.lexically_relative(root).generic_string();
+		}
+
+		std::shared_ptr<const File> find(const std::string_view path) const {
+			std::shared_lock lock{mutex};
+			const auto found = files.find(path);
+			return found == files.end() ? nullptr : found->second;
+		}
+
+		// (re)load one file. kept in memory if it was before, or if it fits
+		void reload(const std::filesystem::path &path) {
+			std::error_code ec;
+			const std::filesystem::directory_entry entry{path, ec};
+			const auto key = url_path(path);
+			if (ec || !entry.is_regular_file(ec)) {
+				std::unique_lock lock{mutex};
+				files.erase(key);
+				return;
+			}
+			const auto previous = find(key);
+			const auto size = entry.file_size(ec);
+			const bool in_memory = !ec && size < options.max_memory_cached && (options.max_memory_total == 0 || (previous && std::holds_alternative<MemoryFile>(previous->contents)));
+			std::shared_ptr<const File> file = build::load_file(entry, in_memory, options);
+			std::unique_lock lock{mutex};
+			if (file)
+				files.insert_or_assign(key, std::move(file));
+			else
+				files.erase(key); // gone again, its own event will follow
+		}
+
+		void run(const std::stop_token &stop) {
+			auto last_rebalance = std::chrono::steady_clock::now();
+			while (!stop.stop_requested()) {
+#ifdef __linux__
+				if (inotify >= 0) {
+					pollfd poll_fd{inotify, POLLIN, 0};
+					if (poll(&poll_fd, 1, 250) > 0)
+						read_events();
+				} else
+#endif
+					std::this_thread::sleep_for(std::chrono::milliseconds(250));
+				if (options.max_memory_total != 0 && std::chrono::steady_clock::now() - last_rebalance >= std::chrono::seconds(1)) {
+					// an exception escaping this thread would end the whole server
+					try {
+						rebalance();
+					} catch (const std::exception &e) {
+						std::cerr << "[EWHTTP]: Rebalancing static files failed: " << e.what() << '\n';
+					}
+					last_rebalance = std::chrono::steady_clock::now();
+				}
+			}
+		}
+
+		/**
+		 * \brief Move the most requested files into memory and the least requested out, keeping within max_memory_total.
+		 */
+		void rebalance() {
+			struct Candidate {
+				std::string key;
+				std::shared_ptr<const File> file;
+				uint32_t hits;
+			};
+			std::vector<Candidate> candidates;
+			{
+				std::shared_lock lock{mutex};
+				candidates.reserve(files.size());
+				for (const auto &[key, file] : files) {
+					// halve every round, so old popularity fades
+					const auto hits = file->hits.load(std::memory_order_relaxed);
+					file->hits.store(hits / 2, std::memory_order_relaxed);
+					if (file->size < options.max_memory_cached)
+						candidates.push_back({key, file, hits});
+				}
+			}
+			std::ranges::stable_sort(candidates, std::greater{}, &Candidate::hits);
+			uintmax_t budget = options.max_memory_total;
+			std::vector<std::pair<std::string, std::shared_ptr<const File>>> replacements;
+			for (auto &candidate : candidates) {
+				const auto &file = *candidate.file;
+				const bool in_memory = std::holds_alternative<MemoryFile>(file.contents);
+				// what it holds now: everything if it's in memory, kept compressed copies if it isn't. moving in costs at least its uncompressed size on top.
+				const auto resident = file.memory_size();
+				const auto estimate = in_memory ? resident : resident + file.size;
+				// in order of popularity, so what's already in memory only stays if nothing hotter needs the room
+				const bool keep = (candidate.hits > 0 || in_memory) && estimate <= budget;
+				if (keep && in_memory) {
+					budget -= resident;
+					continue;
+				}
+				if (!keep && !in_memory && resident <= budget) {
+					budget -= resident;
+					continue;
+				}
+				const auto path = root / candidate.key;
+				std::error_code ec;
+				if (!std::filesystem::is_regular_file(path, ec))
+					continue; // the watcher will handle it
+				std::shared_ptr<const File> moved;
+				if (keep) {
+					// compressing may take more than estimated, check again
+					moved = build::change_tier(file, path, true, true, options);
+					if (moved->memory_size() > budget)
+						moved = nullptr;
+				}
+				if (!moved) {
+					// compressed copies stay in memory while there's room, so responses keep their encoding
+					moved = build::change_tier(file, path, false, true, options);
+					if (moved->memory_size() > budget)
+						moved = build::change_tier(file, path, false, false, options);
+				}
+				budget -= moved->memory_size();
+				if (!in_memory && !std::holds_alternative<MemoryFile>(moved->contents) && moved->encoded.size() == file.encoded.size())
+					continue; // stays as it is
+				replacements.emplace_back(std::move(candidate.key), std::move(moved));
+			}
+			std::unique_lock lock{mutex};
+			for (auto &[key, file] : replacements)
+				if (const auto found = files.find(key); found != files.end())
+					found->second = std::move(file);
+		}
+
+#ifdef __linux__
+		static constexpr uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE;
+
+		void watch_tree(const std::filesystem::path &directory) {
+			if (const int wd = inotify_add_watch(inotify, directory.c_str(), watch_mask); wd >= 0)
+				watches[wd] = directory;
+			std::error_code ec;
+			build::walk(directory, ec, [&](const std::filesystem::directory_entry &member) {
+				std::error_code member_ec;
+				if (member.is_directory(member_ec))
+					if (const int wd = inotify_add_watch(inotify, member.path().c_str(), watch_mask); wd >= 0)
+						watches[wd] = member.path();
+			});
+		}
+
+		void read_events() {
+			alignas(inotify_event) char buffer[16 * 1024];
+			ssize_t length;
+			while ((length = read(inotify, buffer, sizeof(buffer))) > 0) {
+				for (char *ptr = buffer; ptr < buffer + length;) {
+					const auto &event = *reinterpret_cast<const inotify_event *>(ptr);
+					ptr += sizeof(inotify_event) + event.len;
+					if (event.mask & IN_IGNORED) {
+						watches.erase(event.wd);
+						continue;
+					}
+					const auto directory = watches.find(event.wd);
+					if (directory == watches.end() || event.len == 0)
+						continue;
+					const auto path = directory->second / event.name;
+					// a file renamed or deleted again while it's handled mustn't take the server down (this thread ending would)
+					try {
+						handle_event(path, event.mask);
+					} catch (const std::exception &e) {
+						std::cerr << "[EWHTTP]: Reloading " << path << " failed: " << e.what() << '\n';
+						std::unique_lock lock{mutex};
+						files.erase(url_path(path));
+					}
+				}
+			}
+		}
+
+		void handle_event(const std::filesystem::path &path, const uint32_t mask) {
+			if (mask & IN_ISDIR) {
+				if (mask & (IN_CREATE | IN_MOVED_TO)) {
+					// a whole new tree, watch it and load everything already in it
+					watch_tree(path);
+					std::error_code ec;
+					build::walk(path, ec, [&](const std::filesystem::directory_entry &member) {
+						std::error_code member_ec;
+						if (!member.is_directory(member_ec) && !member_ec)
+							reload(member.path());
+					});
+				} else if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+					const auto prefix = url_path(path) + '/';
+					std::unique_lock lock{mutex};
+					std::erase_if(files, [&](const auto &pair) { return pair.first.starts_with(prefix); });
+				}
+				return;
+			}
+			// IN_CREATE alone means it's still being written, wait for IN_CLOSE_WRITE
+			if (mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM))
+				reload(path);
+			// a precompressed sibling changed, so did the variants of the original
+			const auto native = path.native();
+			for (const auto extension : encoding_extensions)
+				if (native.ends_with(extension))
+					if (const auto original = native.substr(0, native.size() - extension.size()); find(url_path(original)))
+						reload(original);
+		}
+#endif
+	};
+} // namespace ewhttp::detail
+
+namespace ewhttp::build {
+	Files::Files(std::string_view path_to_root, const FilesOptions &options) : store{std::make_shared<detail::FileStore>(std::filesystem::path{path_to_root}, options)} {}
+
+	std::shared_ptr<const detail::File> Files::find(const std::string_view path) const {
+		return store->find(path);
+	}
+
+	async Files::operator()(Req request, Res response, const size_t path_progress) const {
 		std::string_view remaining = std::string_view{request.path}.substr(path_progress);
-		if (auto file_pair = files.find(remaining); file_pair != files.end()) {
-			auto &[_, file] = *file_pair;
-			if (auto memory = std::get_if<detail::MemoryFile>(&file)) {
+		// held for the whole response, so a concurrent reload or eviction can't pull it away
+		const auto found = store->find(remaining);
+		if (!found)
+			co_return;
+		const auto &file = *found;
+		file.hits.fetch_add(1, std::memory_order_relaxed);
+		const auto encoded = pick_encoding(request, file);
+		if (!encoded && identity_refused(request)) {
+			response.status = Status::NotAcceptable;
+			if (!file.encoded.empty())
+				response.set_header("Vary", "Accept-Encoding");
+			co_await response.send_body(std::span<const char>{});
+			co_return;
+		}
+		const auto &contents = encoded ? encoded->contents : file.contents;
+		const auto size = encoded ? encoded->size : file.size;
+		const std::string_view etag = encoded ? encoded->etag : file.etag;
+		const auto memory = std::get_if<detail::MemoryFile>(&contents);
+		// opened before anything is set or sent. if it was removed since it was found, it's not found, and the routes after this one answer.
+		std::optional<detail::OpenedFile> opened;
+		if (!memory) {
+			opened.emplace(std::get<detail::StreamingFile>(contents).path);
+			if (!opened->is_open() || opened->size < size)
+				co_return;
+		}
+		response.set_header("ETag", etag);
+		response.set_header("Last-Modified", file.last_modified);
+		response.set_header("Accept-Ranges", "bytes");
+		if (!file.encoded.empty())
+			response.set_header("Vary", "Accept-Encoding");
+		if (encoded)
+			response.set_header("Content-Encoding", detail::encoding_names[static_cast<size_t>(encoded->encoding)]);
+
+		if (not_modified(request, file, etag)) {
+			response.status = Status::NotModified;
+			co_await response.send_headers();
+			response.body_sent = true;
+			co_return;
+		}
+
+		// ranges apply to the selected representation, so to the compressed bytes if it's encoded
+		std::optional<std::vector<ByteRange>> ranges;
+		if (request.method == Method::GET && if_range_matches(request, file, etag))
+			if (const auto header = find_header(request, KnownHeader::range))
+				ranges = parse_ranges(*header, size);
+
+		const auto send_range = [&](const ByteRange &range) -> async {
+			if (memory)
+				co_await response.send_body(std::span<const uint8_t>{memory->data}.subspan(range.first, range.size()));
+			else
+				co_await response.send_file(*opened, range.first, range.size());
+		};
+
+		if (!ranges) {
+			if (memory)
 				co_await response.send_body(memory->data);
+			else
+				co_await response.send_file(*opened, 0, size);
+		} else if (ranges->empty()) {
+			response.status = Status::RangeNotSatisfiable;
+			response.set_header("Content-Range", "bytes */" + std::to_string(size));
+			co_await response.send_body(std::span<const char>{});
+		} else if (ranges->size() == 1) {
+			response.status = Status::PartialContent;
+			response.set_header("Content-Range", content_range(ranges->front(), size));
+			co_await send_range(ranges->front());
+		} else {
+			// multipart/byteranges: every part is "\r\n--boundary\r\nContent-Range: ...\r\n\r\n" + data, then "\r\n--boundary--\r\n"
+			std::vector<std::string> part_headers;
+			part_headers.reserve(ranges->size());
+			uintmax_t length = 0;
+			for (const auto &range : *ranges) {
+				auto &part = part_headers.emplace_back("\r\n--");
+				part += boundary;
+				part += "\r\nContent-Range: ";
+				part += content_range(range, size);
+				part += "\r\n\r\n";
+				length += part.size() + range.size();
+			}
+			const std::string closing = "\r\n--" + std::string{boundary} + "--\r\n";
+			length += closing.size();
+
+			response.status = Status::PartialContent;
+			response.set_header("Content-Type", "multipart/byteranges; boundary=" + std::string{boundary});
+			response.set_header("Content-Length", std::to_string(length));
+			const auto head = response.serialize_headers();
+			if (memory) {
+				// all in one write
+				std::vector<asio::const_buffer> buffers{head.begin(), head.end()};
+				if (!response.omit_body) {
+					for (size_t i = 0; i < ranges->size(); i++) {
+						buffers.emplace_back(part_headers[i].data(), part_headers[i].size());
+						buffers.emplace_back(memory->data.data() + (*ranges)[i].first, (*ranges)[i].size());
+					}
+					buffers.emplace_back(closing.data(), closing.size());
+				}
+				co_await response.write(buffers);
+				response.headers_sent = true;
 			} else {
-				auto &streaming = std::get<detail::StreamingFile>(file);
-				std::ifstream stream(streaming.path, std::ios::binary);
-				stream.unsetf(std::ios::skipws);
-				co_await response.send_body(stream);
+				co_await response.write(head);
+				response.headers_sent = true;
+				if (!response.omit_body) {
+					for (size_t i = 0; i < ranges->size(); i++) {
+						const std::array<asio::const_buffer, 1> part{asio::buffer(part_headers[i])};
+						co_await response.write(part);
+						co_await response.write_file(*opened, (*ranges)[i].first, (*ranges)[i].size());
+					}
+					const std::array<asio::const_buffer, 1> end{asio::buffer(closing)};
+					co_await response.write(end);
+				}
 			}
+			response.body_sent = true;
 		}
 	}
-} // namespace ewhttp::build
\ No newline at end of file
+} // namespace ewhttp::build
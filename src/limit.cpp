@@ -0,0 +1,175 @@
+#include <ewhttp/limit.h>
+#include <ewhttp/status.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <list>
+#include <mutex>
+#include <string>
+
+namespace ewhttp::detail {
+	namespace {
+		using steady_clock = std::chrono::steady_clock;
+		// samples per limit update, at least. more at higher limits, so every update sees a full round of requests.
+		constexpr size_t min_window = 16;
+		// weight of each window in the long-term latency (which follows improvements quicker than slowdowns), and of each new limit in the current one
+		constexpr double long_term_up = 0.05, long_term_down = 0.5, limit_weight = 0.2;
+	} // namespace
+
+	class ConcurrencyLimiter {
+		struct Waiter {
+			asio::steady_timer timer;
+			bool granted = false;
+			std::list<std::shared_ptr<Waiter>>::iterator position{};
+		};
+
+		build::LimitOptions options;
+		// status line, Retry-After and an empty body
+		std::string rejection;
+		// read without the lock by the fast path, written with it (except for taking a free slot)
+		std::atomic<size_t> current_limit, active{0}, queued{0};
+
+		std::mutex mutex;
+		std::list<std::shared_ptr<Waiter>> queue{};
+		double limit_value;
+		// microseconds
+		double long_latency = 0, window_sum = 0;
+		size_t window_count = 0, window_peak = 0;
+
+		// latency of one request that just finished. takes `mutex`.
+		void sample(double micros);
+		// hand free slots to waiters, oldest first. takes `mutex`.
+		void wake();
+		void admitted(Request &request, Response &response) {
+			// request memory is released all at once, and outlives the response
+			void *memory = request.memory()->allocate(sizeof(Admission), alignof(Admission));
+			response.admissions = new (memory) Admission{this, steady_clock::now(), response.admissions};
+		}
+		async reject(Response &response) const {
+			response.status = Status::ServiceUnavailable;
+			const std::array<asio::const_buffer, 1> buffers{asio::buffer(rejection)};
+			co_await response.write(buffers);
+			response.headers_sent = true;
+			response.body_sent = true;
+		}
+		async queue_for(Request &request, Response &response);
+
+	public:
+		explicit ConcurrencyLimiter(const build::LimitOptions &options)
+			: options{options}, current_limit{std::clamp(options.initial_limit, options.min_limit, options.max_limit)}, limit_value{static_cast<double>(current_limit.load())} {
+			rejection = status_line(Status::ServiceUnavailable);
+			rejection += "Retry-After: " + std::to_string(options.retry_after) + "\r\nContent-Length: 0\r\n\r\n";
+		}
+
+		std::optional<async> admit(Request &request, Response &response) {
+			// nobody waiting and a slot free: take it without locking anything
+			if (queued.load(std::memory_order_relaxed) == 0) {
+				auto count = active.load(std::memory_order_relaxed);
+				while (count < current_limit.load(std::memory_order_relaxed))
+					if (active.compare_exchange_weak(count, count + 1, std::memory_order_relaxed)) {
+						admitted(request, response);
+						return std::nullopt;
+					}
+			}
+			return queue_for(request, response);
+		}
+		void release(const steady_clock::time_point start) {
+			const auto micros = std::chrono::duration<double, std::micro>(steady_clock::now() - start).count();
+			{
+				const std::lock_guard lock{mutex};
+				active.fetch_sub(1, std::memory_order_relaxed);
+				sample(micros);
+			}
+			wake();
+		}
+		size_t in_flight() const { return active.load(std::memory_order_relaxed); }
+		size_t limit() const { return current_limit.load(std::memory_order_relaxed); }
+	};
+
+	void ConcurrencyLimiter::sample(const double micros) {
+		window_sum += micros;
+		window_count++;
+		window_peak = std::max(window_peak, active.load(std::memory_order_relaxed) + 1);
+		if (window_count < std::max(min_window, current_limit.load(std::memory_order_relaxed)))
+			return;
+		const double recent = window_sum / static_cast<double>(window_count);
+		const double weight = long_latency == 0 ? 1 : recent < long_latency ? long_term_down : long_term_up;
+		long_latency = long_latency * (1 - weight) + recent * weight;
+		// 1 while recent requests are at most `tolerance` times slower than usual, down to 0.5 the slower they get
+		const double gradient = std::clamp(options.tolerance * long_latency / recent, 0.5, 1.0);
+		// sqrt(limit) of headroom lets the limit grow for as long as latency holds
+		double next = limit_value * gradient + std::sqrt(limit_value);
+		// not even half the slots were used, so there's nothing saying more of them would be fine
+		if (static_cast<double>(window_peak) < limit_value / 2)
+			next = std::min(next, limit_value);
+		limit_value = std::clamp(limit_value * (1 - limit_weight) + next * limit_weight, static_cast<double>(options.min_limit), static_cast<double>(options.max_limit));
+		current_limit.store(static_cast<size_t>(limit_value), std::memory_order_relaxed);
+		window_sum = 0;
+		window_count = 0;
+		window_peak = 0;
+	}
+
+	void ConcurrencyLimiter::wake() {
+		std::vector<std::shared_ptr<Waiter>> granted;
+		{
+			const std::lock_guard lock{mutex};
+			while (!queue.empty() && active.load(std::memory_order_relaxed) < current_limit.load(std::memory_order_relaxed)) {
+				auto waiter = std::move(queue.front());
+				queue.pop_front();
+				queued.fetch_sub(1, std::memory_order_relaxed);
+				active.fetch_add(1, std::memory_order_relaxed);
+				waiter->granted = true;
+				granted.push_back(std::move(waiter));
+			}
+		}
+		// timers belong to the waiters' threads
+		for (auto &waiter : granted)
+			asio::post(waiter->timer.get_executor(), [waiter] { waiter->timer.cancel(); });
+	}
+
+	async ConcurrencyLimiter::queue_for(Request &request, Response &response) {
+		auto waiter = std::make_shared<Waiter>(asio::steady_timer{co_await asio::this_coro::executor});
+		bool rejected = false;
+		{
+			const std::lock_guard lock{mutex};
+			if (active.load(std::memory_order_relaxed) < current_limit.load(std::memory_order_relaxed)) {
+				active.fetch_add(1, std::memory_order_relaxed);
+				waiter->granted = true;
+			} else if (queue.size() >= options.max_queue) {
+				rejected = true;
+			} else {
+				waiter->timer.expires_after(options.queue_timeout);
+				waiter->position = queue.insert(queue.end(), waiter);
+				queued.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		if (!waiter->granted && !rejected) {
+			asio::error_code ec;
+			co_await waiter->timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+			const std::lock_guard lock{mutex};
+			if (!waiter->granted) {
+				// timed out
+				queue.erase(waiter->position);
+				queued.fetch_sub(1, std::memory_order_relaxed);
+				rejected = true;
+			}
+		}
+		if (rejected) {
+			co_await reject(response);
+			co_return;
+		}
+		admitted(request, response);
+	}
+
+	void release(const Admission &admission) {
+		admission.limiter->release(admission.start);
+	}
+} // namespace ewhttp::detail
+
+namespace ewhttp::build {
+	Limit::Limit(const LimitOptions &options) : limiter{std::make_shared<detail::ConcurrencyLimiter>(options)} {}
+	std::optional<async> Limit::admit(Req request, Res response) const { return limiter->admit(request, response); }
+	size_t Limit::in_flight() const { return limiter->in_flight(); }
+	size_t Limit::limit() const { return limiter->limit(); }
+} // namespace ewhttp::build
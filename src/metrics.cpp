@@ -0,0 +1,249 @@
+#include <ewhttp/metrics.h>
+
+#include <charconv>
+#include <deque>
+#include <llhttp.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace ewhttp {
+	namespace {
+		struct Registry {
+			std::mutex mutex;
+			std::deque<detail::ThreadMetrics> blocks;
+			// blocks of threads that exited
+			std::vector<detail::ThreadMetrics *> free_blocks;
+			std::deque<std::string> names;
+			std::deque<detail::RouteLabel> labels;
+			std::unordered_map<std::string_view, const detail::RouteLabel *> by_name;
+
+			Registry() {
+				// id 0, for requests that didn't go through a router
+				intern("");
+			}
+			const detail::RouteLabel *intern(const std::string_view name) {
+				if (const auto found = by_name.find(name); found != by_name.end())
+					return found->second;
+				const auto &stored = names.emplace_back(name);
+				const auto &label = labels.emplace_back(stored, labels.size());
+				by_name.emplace(stored, &label);
+				return &label;
+			}
+		};
+		// never destroyed, threads may still be counting while static destructors run
+		Registry &registry() {
+			static auto &instance = *new Registry;
+			return instance;
+		}
+
+		// claims a block for this thread, and gives it back when the thread exits
+		struct ThreadBlock {
+			detail::ThreadMetrics *block;
+			ThreadBlock() {
+				auto &reg = registry();
+				std::lock_guard lock{reg.mutex};
+				if (reg.free_blocks.empty()) {
+					block = &reg.blocks.emplace_back();
+				} else {
+					block = reg.free_blocks.back();
+					reg.free_blocks.pop_back();
+				}
+			}
+			ThreadBlock(const ThreadBlock &) = delete;
+			~ThreadBlock() {
+				auto &reg = registry();
+				std::lock_guard lock{reg.mutex};
+				reg.free_blocks.push_back(block);
+			}
+		};
+
+		// Prometheus histogram buckets, in microseconds and as written in the le label
+		constexpr std::array<std::pair<uint64_t, std::string_view>, 16> latency_buckets{{
+				{100, "0.0001"},
+				{250, "0.00025"},
+				{500, "0.0005"},
+				{1'000, "0.001"},
+				{2'500, "0.0025"},
+				{5'000, "0.005"},
+				{10'000, "0.01"},
+				{25'000, "0.025"},
+				{50'000, "0.05"},
+				{100'000, "0.1"},
+				{250'000, "0.25"},
+				{500'000, "0.5"},
+				{1'000'000, "1"},
+				{2'500'000, "2.5"},
+				{5'000'000, "5"},
+				{10'000'000, "10"},
+		}};
+
+		void append_number(std::string &out, const uint64_t number) {
+			std::array<char, 20> chars;
+			out.append(chars.data(), std::to_chars(chars.data(), chars.data() + chars.size(), number).ptr);
+		}
+		void append_label_value(std::string &out, const std::string_view value) {
+			for (const char c : value) {
+				if (c == '\\' || c == '"') out += '\\';
+				if (c == '\n') {
+					out += "\\n";
+					continue;
+				}
+				out += c;
+			}
+		}
+		void append_header(std::string &out, const std::string_view name, const std::string_view type, const std::string_view help) {
+			out += "# HELP ";
+			out += name;
+			out += ' ';
+			out += help;
+			out += "\n# TYPE ";
+			out += name;
+			out += ' ';
+			out += type;
+			out += '\n';
+		}
+		void append_sample(std::string &out, const std::string_view name, const std::string_view labels, const uint64_t value) {
+			out += name;
+			if (!labels.empty()) {
+				out += '{';
+				out += labels;
+				out += '}';
+			}
+			out += ' ';
+			append_number(out, value);
+			out += '\n';
+		}
+	} // namespace
+
+	namespace detail {
+		const RouteLabel *intern_route(const std::string_view name) {
+			auto &reg = registry();
+			std::lock_guard lock{reg.mutex};
+			return reg.intern(name);
+		}
+
+		ThreadMetrics &thread_metrics() {
+			thread_local const ThreadBlock block;
+			return *block.block;
+		}
+
+		void ThreadMetrics::record(const Response &response, const MethodT method, const std::chrono::steady_clock::duration duration) {
+			requests.add();
+			const auto code = response.status.code;
+			responses[code >= 100 && code < 600 ? code / 100 : 0].add();
+			const size_t id = response.route ? response.route->id : 0;
+			if (id >= max_routes || method.id >= method_names.size())
+				return;
+			// only this thread stores here, readers on other threads acquire
+			auto *stats = routes[id].load(std::memory_order_relaxed);
+			if (!stats) {
+				stats = new RouteStats;
+				routes[id].store(stats, std::memory_order_release);
+			}
+			stats->methods[method.id].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count()));
+		}
+	} // namespace detail
+
+	namespace metrics {
+		std::string prometheus() {
+			auto &reg = registry();
+			std::lock_guard lock{reg.mutex};
+			const auto sum = [&](auto get) {
+				uint64_t total = 0;
+				for (const auto &block : reg.blocks) total += get(block);
+				return total;
+			};
+			std::string out;
+
+			append_header(out, "ewhttp_requests_total", "counter", "Requests handled.");
+			append_sample(out, "ewhttp_requests_total", {}, sum([](const auto &b) { return b.requests.get(); }));
+			append_header(out, "ewhttp_responses_total", "counter", "Responses by status class.");
+			for (size_t status_class = 1; status_class < 6; status_class++) {
+				std::string labels = "class=\"0xx\"";
+				labels[7] = static_cast<char>('0' + status_class);
+				append_sample(out, "ewhttp_responses_total", labels, sum([&](const auto &b) { return b.responses[status_class].get(); }));
+			}
+			append_header(out, "ewhttp_handler_exceptions_total", "counter", "Handlers that threw.");
+			append_sample(out, "ewhttp_handler_exceptions_total", {}, sum([](const auto &b) { return b.handler_exceptions.get(); }));
+
+			const auto opened = sum([](const auto &b) { return b.connections_opened.get(); });
+			const auto closed = sum([](const auto &b) { return b.connections_closed.get(); });
+			append_header(out, "ewhttp_connections_total", "counter", "Connections accepted.");
+			append_sample(out, "ewhttp_connections_total", {}, opened);
+			append_header(out, "ewhttp_connections_active", "gauge", "Connections currently open.");
+			append_sample(out, "ewhttp_connections_active", {}, opened - closed);
+			append_header(out, "ewhttp_received_bytes_total", "counter", "Bytes read from clients.");
+			append_sample(out, "ewhttp_received_bytes_total", {}, sum([](const auto &b) { return b.bytes_in.get(); }));
+			append_header(out, "ewhttp_sent_bytes_total", "counter", "Bytes written to clients.");
+			append_sample(out, "ewhttp_sent_bytes_total", {}, sum([](const auto &b) { return b.bytes_out.get(); }));
+
+			append_header(out, "ewhttp_parse_errors_total", "counter", "Requests llhttp rejected, by error.");
+			for (size_t code = 0; code < detail::ThreadMetrics::parse_error_codes; code++) {
+				const auto count = sum([&](const auto &b) { return b.parse_errors[code].get(); });
+				if (count == 0) continue;
+				std::string labels = "error=\"";
+				append_label_value(labels, llhttp_errno_name(static_cast<llhttp_errno_t>(code)));
+				labels += '"';
+				append_sample(out, "ewhttp_parse_errors_total", labels, count);
+			}
+
+			append_header(out, "ewhttp_request_duration_seconds", "histogram", "Time from the end of the request headers until the handler finished, by route and method.");
+			const auto route_count = std::min(reg.labels.size(), detail::ThreadMetrics::max_routes);
+			for (size_t id = 0; id < route_count; id++) {
+				for (uint8_t method = 0; method < detail::method_names.size(); method++) {
+					std::array<uint64_t, detail::Histogram::bucket_count> buckets{};
+					uint64_t count = 0, sum_micros = 0;
+					for (const auto &block : reg.blocks) {
+						const auto *stats = block.routes[id].load(std::memory_order_acquire);
+						if (!stats) continue;
+						const auto &histogram = stats->methods[method];
+						for (size_t i = 0; i < buckets.size(); i++) buckets[i] += histogram.buckets[i].get();
+						count += histogram.count.get();
+						sum_micros += histogram.sum_micros.get();
+					}
+					if (count == 0) continue;
+
+					std::string labels = "route=\"";
+					append_label_value(labels, reg.labels[id].name);
+					labels += "\",method=\"";
+					labels += detail::method_names[method];
+					labels += '"';
+					size_t bucket = 0;
+					uint64_t cumulative = 0;
+					for (const auto &[micros, le] : latency_buckets) {
+						// everything in a bucket is at most its upper bound - 1
+						while (bucket < buckets.size() && detail::Histogram::upper_bound(bucket) <= micros + 1)
+							cumulative += buckets[bucket++];
+						std::string bucket_labels = labels;
+						bucket_labels += ",le=\"";
+						bucket_labels += le;
+						bucket_labels += '"';
+						append_sample(out, "ewhttp_request_duration_seconds_bucket", bucket_labels, cumulative);
+					}
+					append_sample(out, "ewhttp_request_duration_seconds_bucket", labels + ",le=\"+Inf\"", count);
+					// microseconds -> seconds without going through floating point formatting
+					out += "ewhttp_request_duration_seconds_sum{";
+					out += labels;
+					out += "} ";
+					append_number(out, sum_micros / 1'000'000);
+					out += '.';
+					const auto fraction = std::to_string(1'000'000 + sum_micros % 1'000'000);
+					out.append(fraction, 1);
+					out += '\n';
+					append_sample(out, "ewhttp_request_duration_seconds_count", labels, count);
+				}
+			}
+			return out;
+		}
+	} // namespace metrics
+
+	namespace build {
+		async Metrics::operator()(Req, Res response) const {
+			static const HeaderBlock headers{{"Content-Type", "text/plain; version=0.0.4; charset=utf-8"}};
+			response.add_headers(headers);
+			const auto body = metrics::prometheus();
+			co_await response.send_body(std::span<const char>{body});
+		}
+	} // namespace build
+} // namespace ewhttp
@@ -0,0 +1,162 @@
+#include <ewhttp/rate_limit.h>
+#include <ewhttp/status.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace ewhttp::detail {
+	namespace {
+		using steady_clock = std::chrono::steady_clock;
+
+		// splitmix64's finalizer
+		constexpr uint64_t mix(uint64_t x) {
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+			return x ^ (x >> 31);
+		}
+
+		uint64_t hash(const asio::ip::address &address) {
+			if (address.is_v4())
+				return mix(address.to_v4().to_uint());
+			const auto bytes = address.to_v6().to_bytes();
+			uint64_t high, low;
+			std::memcpy(&high, bytes.data(), 8);
+			std::memcpy(&low, bytes.data() + 8, 8);
+			return mix(high ^ mix(low));
+		}
+
+		// "client, proxy1, proxy2" -> "proxy2"
+		std::string_view last_item(std::string_view list) {
+			if (const auto comma = list.rfind(','); comma != std::string_view::npos)
+				list.remove_prefix(comma + 1);
+			while (!list.empty() && (list.front() == ' ' || list.front() == '\t')) list.remove_prefix(1);
+			while (!list.empty() && (list.back() == ' ' || list.back() == '\t')) list.remove_suffix(1);
+			return list;
+		}
+	} // namespace
+
+	class RateLimiter {
+		/*
+		 * A bucket is one 64 bit word, so it's updated with a single compare-and-swap:
+		 * | tag (16) | time of the last refill (32) | tokens (16) |
+		 * tokens are counted in sixteenths, time in how long one sixteenth takes to refill. the time wraps around every 2^32 of those.
+		 * a bucket that looks up to max_skew in the future was written by a thread with a slightly later clock, anything further is a client
+		 * that was idle long enough for the clock to wrap, and gets a full bucket. only a return within max_skew before a whole multiple
+		 * of 2^32 is mistaken for a race, and then the bucket refills max_skew late at most.
+		 */
+		static constexpr uint64_t token = 16;
+		static constexpr uint16_t tag(const uint64_t bucket) { return static_cast<uint16_t>(bucket >> 48); }
+		static constexpr uint32_t time(const uint64_t bucket) { return static_cast<uint32_t>(bucket >> 16); }
+		static constexpr uint64_t tokens(const uint64_t bucket) { return bucket & 0xffff; }
+		static constexpr uint64_t pack(const uint16_t tag, const uint32_t time, const uint64_t tokens) {
+			return static_cast<uint64_t>(tag) << 48 | static_cast<uint64_t>(time) << 16 | tokens;
+		}
+		// at least one request a day, so Retry-After and the clock's scale stay finite. at most a billion a second, so the clock fits 64 bits for decades.
+		static constexpr double min_rate = 1.0 / 86400, max_rate = 1e9;
+		// written so NaN ends up at min_rate too
+		static constexpr double valid_rate(const double rate) { return rate >= min_rate ? std::min(rate, max_rate) : min_rate; }
+		// how far another thread's `now` may be ahead of this one's. a millisecond at the highest rate.
+		static constexpr int32_t max_skew = 1 << 24;
+		static constexpr int32_t elapsed(const uint32_t now, const uint64_t bucket) {
+			const auto difference = static_cast<int32_t>(now - time(bucket));
+			if (difference >= 0) return difference;
+			return difference >= -max_skew ? 0 : INT32_MAX;
+		}
+
+		// 8 buckets, one cache line. a client's bucket is somewhere in the line its hash picks.
+		struct alignas(64) Line {
+			std::array<std::atomic<uint64_t>, 8> buckets{};
+		};
+
+		build::RateLimitOptions options;
+		uint64_t full;
+		// sixteenths of a token refilled per nanosecond
+		double units_per_ns;
+		steady_clock::time_point start = steady_clock::now();
+		size_t line_mask;
+		std::unique_ptr<Line[]> lines;
+		// status line, Retry-After and an empty body
+		std::string rejection;
+
+		// take a token from a client's bucket, or find it's empty. `bucket` was just loaded from `slot`.
+		static bool take(std::atomic<uint64_t> &slot, uint64_t bucket, const uint16_t client, const uint32_t now, const uint64_t full) {
+			for (;;) {
+				const auto passed = elapsed(now, bucket);
+				const auto available = std::min<uint64_t>(full, tokens(bucket) + passed);
+				if (available < token)
+					return false;
+				// a full bucket has no use for time beyond now, and after a wrap `passed` isn't a real duration
+				const uint32_t refilled = available == full ? now : time(bucket) + passed;
+				if (slot.compare_exchange_weak(bucket, pack(client, refilled, available - token), std::memory_order_relaxed))
+					return true;
+				if (tag(bucket) != client)
+					return true; // taken over by another client meanwhile, let this one through
+			}
+		}
+
+	public:
+		explicit RateLimiter(const build::RateLimitOptions &options)
+			: options{options}, full{std::clamp(options.burst, 1u, 4095u) * token}, units_per_ns{valid_rate(options.rate) * token / 1e9},
+			  line_mask{std::bit_ceil(std::max<size_t>(options.clients / 8, 1)) - 1}, lines{std::make_unique<Line[]>(line_mask + 1)} {
+			rejection = status_line(Status::TooManyRequests);
+			rejection += "Retry-After: " + std::to_string(std::max(1, static_cast<int>(std::ceil(1 / valid_rate(options.rate))))) + "\r\nContent-Length: 0\r\n\r\n";
+		}
+
+		bool allow(const uint64_t hash) const {
+			auto &line = lines[hash & line_mask];
+			// never 0, so empty buckets don't match anyone
+			const auto client = static_cast<uint16_t>(hash >> 48 | 1);
+			// through 64 bits, converting a double past 2^32 straight to uint32_t is undefined rather than wrapping
+			const auto now = static_cast<uint32_t>(static_cast<uint64_t>(static_cast<double>((steady_clock::now() - start).count()) * units_per_ns));
+			std::atomic<uint64_t> *oldest = &line.buckets[0];
+			uint64_t oldest_bucket = 0;
+			int32_t oldest_age = 0;
+			for (auto &slot : line.buckets) {
+				const auto bucket = slot.load(std::memory_order_relaxed);
+				if (tag(bucket) == client)
+					return take(slot, bucket, client, now, full);
+				const auto age = bucket == 0 ? INT32_MAX : elapsed(now, bucket);
+				if (age >= oldest_age) {
+					oldest = &slot;
+					oldest_bucket = bucket;
+					oldest_age = age;
+				}
+			}
+			// a new client, in the bucket idle the longest. if another thread got to it first, it's fine to lose this one.
+			oldest->compare_exchange_strong(oldest_bucket, pack(client, now, full - token), std::memory_order_relaxed);
+			return true;
+		}
+
+		uint64_t key(const Request &request) const {
+			if (!options.key_header.empty())
+				if (const auto value = request.header(options.key_header))
+					return mix(std::hash<std::string_view>{}(last_item(*value)));
+			return hash(request.remote_address());
+		}
+
+		async reject(Response &response) const {
+			response.status = Status::TooManyRequests;
+			const std::array<asio::const_buffer, 1> buffers{asio::buffer(rejection)};
+			co_await response.write(buffers);
+			response.headers_sent = true;
+			response.body_sent = true;
+		}
+	};
+} // namespace ewhttp::detail
+
+namespace ewhttp::build {
+	RateLimit::RateLimit(const RateLimitOptions &options) : limiter{std::make_shared<detail::RateLimiter>(options)} {}
+
+	std::optional<async> RateLimit::check(Req request, Res response) const {
+		if (limiter->allow(limiter->key(request)))
+			return std::nullopt;
+		return limiter->reject(response);
+	}
+} // namespace ewhttp::build
@@ -0,0 +1,202 @@
+#include <ewhttp/request.h>
+#include <ewhttp/server.h>
+#include <algorithm>
+#include <charconv>
+
+namespace ewhttp {
+	namespace detail {
+		void ArenaReturn::operator()(Arena *arena) const {
+			arena->resource.release();
+			context->free_arenas.emplace_back(arena);
+		}
+	} // namespace detail
+
+	namespace {
+		std::unique_ptr<detail::Arena, detail::ArenaReturn> take_arena(detail::RequestContext *context) {
+			auto &free = context->free_arenas;
+			if (free.empty())
+				return {new detail::Arena, {context}};
+			std::unique_ptr<detail::Arena, detail::ArenaReturn> arena{free.back().release(), {context}};
+			free.pop_back();
+			return arena;
+		}
+
+		using Params = std::pmr::vector<std::pair<std::string_view, std::string_view>>;
+
+		std::string_view trim(std::string_view value) {
+			while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+			while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+			return value;
+		}
+
+		// "a=1&b=2" or "a=1; b=2", split on `separator`. empty items are skipped, items without '=' get an empty value.
+		void parse_params(std::string_view list, const char separator, const bool plus, const bool trimmed, Params &into) {
+			auto &memory = *into.get_allocator().resource();
+			while (!list.empty()) {
+				const auto end = list.find(separator);
+				auto item = list.substr(0, end);
+				list = end == std::string_view::npos ? std::string_view{} : list.substr(end + 1);
+				if (trimmed) item = trim(item);
+				if (item.empty()) continue;
+				const auto equals = item.find('=');
+				auto value = equals == std::string_view::npos ? std::string_view{} : item.substr(equals + 1);
+				auto name = item.substr(0, equals);
+				if (trimmed) {
+					name = trim(name);
+					value = trim(value);
+					// cookie values may be quoted
+					if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+						value = value.substr(1, value.size() - 2);
+				}
+				into.emplace_back(detail::percent_decode(name, plus, memory), detail::percent_decode(value, plus, memory));
+			}
+		}
+
+		std::optional<std::string_view> find_param(const Params &params, const std::string_view name) {
+			for (const auto &[key, value] : params)
+				if (key == name)
+					return value;
+			return std::nullopt;
+		}
+	} // namespace
+
+	Request::Request(const MethodT method, detail::RequestContext *context) : arena{take_arena(context)}, method{method}, headers{&arena->resource}, context{context}, spilled{&arena->resource} {}
+
+	Request &Request::operator=(Request &&other) noexcept {
+		if (this == &other)
+			return *this;
+		// polymorphic allocators don't follow an assignment, so the containers are rebuilt with `other`'s arena instead of assigned.
+		// ours go first, while the arena they're in is still ours. moving a container takes its allocator along, so nothing here allocates.
+		std::destroy_at(&parsed_cookies);
+		std::destroy_at(&parsed_query);
+		std::destroy_at(&spilled);
+		std::destroy_at(&headers);
+		arena = std::move(other.arena);
+		std::construct_at(&headers, std::move(other.headers));
+		std::construct_at(&spilled, std::move(other.spilled));
+		std::construct_at(&parsed_query, std::move(other.parsed_query));
+		std::construct_at(&parsed_cookies, std::move(other.parsed_cookies));
+		method = other.method;
+		path = other.path;
+		query = other.query;
+		context = other.context;
+		sequence = other.sequence;
+		buffer = std::move(other.buffer);
+		body_buffer = std::move(other.body_buffer);
+		known_header_slots = other.known_header_slots;
+		return *this;
+	}
+
+	awaitopt<std::string_view> Request::read_chunk() {
+		auto &body = context->body;
+		if (body.sequence != sequence)
+			co_return std::nullopt; // a later request is being parsed, so this body is long done
+		if (body.state == body.taken) {
+			// done with the previous chunk, let the parser continue
+			body.state = body.parsing;
+			context->notify();
+		}
+		while (body.state == body.parsing && !body.complete)
+			co_await context->wait();
+		if (body.state == body.ready) {
+			body.state = body.taken;
+			co_return body.chunk;
+		}
+		co_return std::nullopt;
+	}
+
+	awaitopt<std::string_view> Request::read_body(const size_t max_size) {
+		std::string_view result{};
+		// where the body is gathered once it stops arriving contiguously, grown in place rather than copied per chunk
+		std::pmr::string *collected = nullptr;
+		while (auto chunk = co_await read_chunk()) {
+			if (result.size() + chunk->size() > max_size)
+				co_return std::nullopt;
+			if (!collected) {
+				// the parser is paused, so the chunk is in the block it's currently reading into
+				if (result.empty()) {
+					body_buffer = context->buffer;
+					result = *chunk;
+					continue;
+				}
+				if (body_buffer == context->buffer && result.data() + result.size() == chunk->data()) {
+					result = std::string_view{result.data(), result.size() + chunk->size()};
+					continue;
+				}
+				collected = &spilled.emplace_back();
+				size_t expected = 0;
+				if (const auto length = header(KnownHeader::content_length))
+					std::from_chars(length->data(), length->data() + length->size(), expected);
+				collected->reserve(expected <= max_size ? std::max(expected, result.size() + chunk->size()) : result.size() + chunk->size());
+				collected->append(result);
+				body_buffer.reset();
+			}
+			collected->append(*chunk);
+			result = *collected;
+		}
+		co_return result;
+	}
+
+	std::optional<std::string_view> Request::find_header(const std::string_view name) const {
+		for (const auto &[key, value] : headers)
+			if (detail::iequals(key, name))
+				return value;
+		return std::nullopt;
+	}
+
+	std::pmr::vector<std::string_view> Request::header_values(const std::string_view name) const {
+		std::pmr::vector<std::string_view> values{memory()};
+		for (const auto &[key, value] : headers)
+			if (detail::iequals(key, name))
+				values.push_back(value);
+		return values;
+	}
+
+	const std::pmr::vector<std::pair<std::string_view, std::string_view>> &Request::query_params() const {
+		if (!parsed_query) {
+			parsed_query.emplace(memory());
+			parse_params(query, '&', true, false, *parsed_query);
+		}
+		return *parsed_query;
+	}
+
+	std::optional<std::string_view> Request::query_param(const std::string_view name) const {
+		return find_param(query_params(), name);
+	}
+
+	const std::pmr::vector<std::pair<std::string_view, std::string_view>> &Request::cookies() const {
+		if (!parsed_cookies) {
+			parsed_cookies.emplace(memory());
+			for (const auto &[key, value] : headers)
+				if (detail::iequals(key, "Cookie"))
+					parse_params(value, ';', false, true, *parsed_cookies);
+		}
+		return *parsed_cookies;
+	}
+
+	std::optional<std::string_view> Request::cookie(const std::string_view name) const {
+		return find_param(cookies(), name);
+	}
+
+	const asio::ip::address &Request::remote_address() const {
+		return context->remote;
+	}
+
+	void Request::append(std::string_view &target, const std::string_view data, const std::shared_ptr<detail::ReadBuffer> &from) {
+		if (!buffer) buffer = from;
+		if (buffer == from) {
+			if (target.empty()) {
+				target = data;
+				return;
+			}
+			if (buffer->contains(target.data()) && target.data() + target.size() == data.data()) {
+				target = std::string_view{target.data(), target.size() + data.size()};
+				return;
+			}
+		}
+		// split over two blocks (or the read buffer was swapped mid-request), copy
+		auto &copy = spilled.emplace_back(target);
+		copy += data;
+		target = copy;
+	}
+} // namespace ewhttp
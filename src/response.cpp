@@ -1,104 +1,408 @@
 #include "ewhttp/response.h"
+#include "ewhttp/limit.h"
 #include "ewhttp/request.h"
 #include "ewhttp/server.h"
 
-
+#include <algorithm>
+#include <charconv>
+#include <fstream>
 #include <iostream>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace ewhttp {
+	namespace {
+		constexpr std::string_view crlf = "\r\n";
+
+		// formats into a stack buffer, to not allocate a std::string for every Content-Length
+		struct NumberString {
+			std::array<char, 20> chars;
+			std::string_view view;
+			explicit NumberString(const size_t number) {
+				view = {chars.data(), static_cast<size_t>(std::to_chars(chars.data(), chars.data() + chars.size(), number).ptr - chars.data())};
+			}
+		};
+
+	} // namespace
+
+	namespace detail {
+		OpenedFile::OpenedFile(std::filesystem::path path_param) : path{std::move(path_param)} {
+#ifdef __linux__
+			fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat info{};
+			if (fd < 0 || ::fstat(fd, &info) < 0) {
+				error = errno;
+				return;
+			}
+			size = static_cast<uintmax_t>(info.st_size);
+#else
+			std::error_code ec;
+			size = std::filesystem::file_size(path, ec);
+			stream.open(path, std::ios::binary);
+			if (ec || !stream)
+				error = ec ? ec.value() : ENOENT;
+#endif
+		}
+		OpenedFile::~OpenedFile() {
+#ifdef __linux__
+			if (fd >= 0) ::close(fd);
+#endif
+		}
+	} // namespace detail
+
+	HeaderBlock::HeaderBlock(const std::initializer_list<std::pair<std::string_view, std::string_view>> headers) {
+		for (const auto &[key, value] : headers) {
+			serialized += key;
+			serialized += ": ";
+			serialized += value;
+			serialized += crlf;
+		}
+	}
+
+	Response::~Response() {
+		release_admissions();
+	}
+
+	void Response::release_admissions() {
+		for (auto admission = std::exchange(admissions, nullptr); admission; admission = admission->next)
+			detail::release(*admission);
+	}
+
+	std::array<asio::const_buffer, 3> Response::serialize_headers() {
+		auto status_line = detail::status_line(status);
+		if (status_line.empty()) {
+			// unknown status, no reason phrase
+			auto end = std::ranges::copy(detail::status_line_prefix, custom_status_line.data()).out;
+			end = std::to_chars(end, custom_status_line.data() + custom_status_line.size() - 3, status.code).ptr;
+			*end++ = ' ';
+			*end++ = '\r';
+			*end++ = '\n';
+			status_line = {custom_status_line.data(), static_cast<size_t>(end - custom_status_line.data())};
+		}
+		const auto lines = headers.serialized();
+		return {asio::buffer(status_line.data(), status_line.size()), asio::buffer(lines.data(), lines.size()), asio::buffer(crlf.data(), crlf.size())};
+	}
+
+	async Response::write(const std::span<const asio::const_buffer> buffers) {
+		if (capture) {
+			size_t size = 0;
+			for (const auto &buffer : buffers) size += buffer.size();
+			if (capture->bytes.size() + size <= capture->limit) {
+				for (const auto &buffer : buffers)
+					capture->bytes.append(static_cast<const char *>(buffer.data()), buffer.size());
+				co_return;
+			}
+			// too large to be stored, so there's no point holding it back
+			co_await release_capture();
+		}
+		// wait for the responses to earlier pipelined requests
+		while (context.responses_done != sequence)
+			co_await context.wait();
+		context.metrics->bytes_out.add(co_await asio::async_write(context.socket, buffers, asio::use_awaitable));
+	}
+
+	async Response::release_capture() {
+		auto &held = *std::exchange(capture, nullptr);
+		held.released = true;
+		const std::array<asio::const_buffer, 1> buffers{asio::buffer(held.bytes)};
+		co_await write(buffers);
+		held.bytes.clear();
+		held.bytes.shrink_to_fit();
+	}
+
 	async Response::send_headers() {
 		assert(!headers_sent);
-		asio::streambuf b;
-		std::ostream os(&b);
-		os << "HTTP/1.1 " << status.code << ' ' << status.name() << "\r\n";
-		for (const auto &[key, values] : headers)
-			for (const auto &value : values)
-				os << key << ": " << value << "\r\n";
-		os << "\r\n";
-		co_await asio::async_write(context.socket, b, asio::use_awaitable);
+		co_await write(serialize_headers());
 		headers_sent = true;
 	}
 
 	async Response::send_body(const std::span<const unsigned char> &body) {
-		assert(!body_sent);
-		if (!headers_sent) {
-			set_header("Content-Length", std::to_string(body.size_bytes()));
-			co_await send_headers();
-		}
-		co_await asio::async_write(context.socket, asio::buffer(body), asio::use_awaitable);
-		body_sent = true;
+		co_await send_body(std::span<const char>{reinterpret_cast<const char *>(body.data()), body.size()});
 	}
 	async Response::send_body(const std::span<const char> &body) {
 		assert(!body_sent);
-		if (!headers_sent) {
-			set_header("Content-Length", std::to_string(body.size_bytes()));
-			co_await send_headers();
+		const auto body_buffer = asio::buffer(body.data(), omit_body ? 0 : body.size());
+		if (headers_sent) {
+			const std::array<asio::const_buffer, 1> buffers{body_buffer};
+			co_await write(buffers);
+		} else {
+			// headers and body in one write
+			set_header("Content-Length", NumberString{body.size_bytes()}.view);
+			const auto [status_line, lines, end] = serialize_headers();
+			const std::array<asio::const_buffer, 4> buffers{status_line, lines, end, body_buffer};
+			co_await write(buffers);
+			headers_sent = true;
 		}
-		co_await asio::async_write(context.socket, asio::buffer(body), asio::use_awaitable);
 		body_sent = true;
 	}
 	async Response::send_body(std::istream &body, size_t size) {
 		assert(!body_sent);
+		std::array<asio::const_buffer, 3> head{};
 		if (!headers_sent) {
-			set_header("Content-Length", std::to_string(size));
-			co_await send_headers();
+			set_header("Content-Length", NumberString{size}.view);
+			head = serialize_headers();
 		}
 		asio::streambuf b;
 		std::ostream os(&b);
-		os << body.rdbuf();
-		co_await asio::async_write(context.socket, b, asio::use_awaitable);
+		if (!omit_body)
+			os << body.rdbuf();
+		const std::array<asio::const_buffer, 4> buffers{head[0], head[1], head[2], b.data()};
+		co_await write(buffers);
+		headers_sent = true;
 		body_sent = true;
 	}
 
 	async Response::send_body(std::istream &body) {
+		assert(!body_sent);
+		auto writer = stream();
+		if (!omit_body) {
+			std::array<char, 1024 * 8> buffer;
+			do {
+				body.read(buffer.data(), buffer.size());
+				co_await writer.write({buffer.data(), static_cast<size_t>(body.gcount())});
+			} while (body.good());
+			if (!body.eof()) // not good, no eof
+				throw std::runtime_error("Error reading from stream");
+		}
+		co_await writer.finish();
+	}
+
+	async Response::send_file(const std::filesystem::path &path, const uintmax_t offset, const uintmax_t length) {
+		detail::OpenedFile file{path};
+		if (!file.is_open())
+			throw std::system_error(file.error, std::generic_category(), "Error opening " + path.string());
+		co_await send_file(file, offset, length);
+	}
+
+	async Response::send_file(detail::OpenedFile &file, const uintmax_t offset, const uintmax_t length) {
 		assert(!body_sent);
 		if (!headers_sent) {
-			set_header("Transfer-Encoding", "chunked");
+			set_header("Content-Length", NumberString{length}.view);
 			co_await send_headers();
 		}
-		while (body.good()) {
-			std::array<char, 1024 * 8> buffer;
-			body.read(buffer.data(), buffer.size());
-			auto amount = body.gcount();
-			asio::streambuf b;
-			std::ostream os(&b);
-			os << std::hex << amount << "\r\n";
-			co_await asio::async_write(context.socket, b, asio::use_awaitable);
-			co_await asio::async_write(context.socket, asio::buffer(buffer, amount), asio::use_awaitable);
-			co_await asio::async_write(context.socket, asio::buffer("\r\n", 2), asio::use_awaitable);
-		}
-		co_await asio::async_write(context.socket, asio::buffer("0\r\n\r\n", 5), asio::use_awaitable);
-		if (!body.eof()) // not good, no eof
-			throw std::runtime_error("Error reading from stream");
+		co_await write_file(file, offset, length);
 		body_sent = true;
 	}
 
+	BodyWriter Response::stream(const size_t buffer_size) {
+		assert(!body_sent);
+		bool chunked = !has_header("Content-Length");
+		if (headers_sent) {
+			// the framing is whatever already went out
+			chunked = false;
+			for (const auto value : get_header("Transfer-Encoding"))
+				chunked = value.size() >= 7 && detail::iequals(value.substr(value.size() - 7), "chunked");
+			assert((chunked || has_header("Content-Length")) && "stream() after send_headers() needs Content-Length or Transfer-Encoding: chunked");
+		} else if (chunked) {
+			set_header("Transfer-Encoding", "chunked");
+		}
+		writer_open = true;
+		return {*this, buffer_size, chunked};
+	}
+
+	EventStream Response::event_stream(const size_t buffer_size) {
+		if (!headers_sent) {
+			set_header("Content-Type", "text/event-stream");
+			set_header("Cache-Control", "no-cache");
+		}
+		// events are for seeing as they happen, a cache holding them back until the stream ends would defeat that
+		if (capture)
+			capture->limit = 0;
+		return EventStream{stream(buffer_size)};
+	}
+
+	async BodyWriter::send(const std::string_view data, const bool last) {
+		constexpr std::string_view terminator = "0\r\n\r\n";
+		std::array<asio::const_buffer, 3> head{};
+		if (!response.headers_sent)
+			head = response.serialize_headers();
+		const bool chunk = chunked && !data.empty() && !response.omit_body;
+		std::array<char, 2 * sizeof(size_t) + 2> size_line;
+		auto end = std::to_chars(size_line.data(), size_line.data() + size_line.size(), data.size(), 16).ptr;
+		*end++ = '\r';
+		*end++ = '\n';
+		const std::array<asio::const_buffer, 7> buffers{
+				head[0],
+				head[1],
+				head[2],
+				asio::buffer(size_line.data(), chunk ? end - size_line.data() : 0),
+				asio::buffer(data.data(), response.omit_body ? 0 : data.size()),
+				asio::buffer(crlf.data(), chunk ? crlf.size() : 0),
+				asio::buffer(terminator.data(), last && chunked && !response.omit_body ? terminator.size() : 0),
+		};
+		co_await response.write(buffers);
+		response.headers_sent = true;
+		if (last) {
+			response.body_sent = true;
+			response.writer_open = false;
+		}
+	}
+
+	async BodyWriter::write(const std::span<const char> data) {
+		assert(!response.body_sent);
+		if (pending.size() + data.size() <= buffer_size) {
+			pending.append(data.data(), data.size());
+			co_return;
+		}
+		co_await flush();
+		if (data.size() >= buffer_size) {
+			// would fill the buffer on its own, no point copying it
+			co_await send({data.data(), data.size()}, false);
+		} else {
+			pending.append(data.data(), data.size());
+		}
+	}
+
+	async BodyWriter::flush() {
+		assert(!response.body_sent);
+		// an empty chunk would end the body, only the headers can be sent without data
+		if (pending.empty() && response.headers_sent)
+			co_return;
+		co_await send(pending, false);
+		pending.clear();
+	}
+
+	async BodyWriter::finish() {
+		assert(!response.body_sent);
+		co_await send(pending, true);
+		pending.clear();
+		pending.shrink_to_fit();
+	}
+
+	async EventStream::send(std::string_view data, const std::string_view event, const std::string_view id) {
+		// the whole event is appended to the buffer directly, only the socket is awaited
+		auto &pending = body.pending;
+		if (!event.empty()) {
+			pending += "event: ";
+			pending += event;
+			pending += '\n';
+		}
+		if (!id.empty()) {
+			pending += "id: ";
+			pending += id;
+			pending += '\n';
+		}
+		// CRLF, CR and LF all end a line
+		while (true) {
+			const auto line_end = data.find_first_of("\r\n");
+			pending += "data: ";
+			pending += data.substr(0, line_end);
+			pending += '\n';
+			if (line_end == std::string_view::npos) break;
+			data.remove_prefix(line_end + (data.substr(line_end, 2) == crlf ? 2 : 1));
+		}
+		pending += '\n';
+		if (pending.size() >= body.buffer_size)
+			co_await body.flush();
+	}
+
+	async EventStream::comment(const std::string_view text) {
+		auto &pending = body.pending;
+		pending += ": ";
+		pending += text;
+		pending += "\n\n";
+		if (pending.size() >= body.buffer_size)
+			co_await body.flush();
+	}
+
+	async Response::write_file(detail::OpenedFile &file, const uintmax_t offset, const uintmax_t length) {
+		if (omit_body)
+			co_return;
+		const auto &path = file.path;
+		if (capture && capture->bytes.size() + length > capture->limit)
+			co_await release_capture();
+		if (capture) {
+			// from the file that's already open, it may have been replaced on disk since
+			const auto start = capture->bytes.size();
+			capture->bytes.resize(start + length);
+			char *into = capture->bytes.data() + start;
+#ifdef __linux__
+			for (uintmax_t done = 0; done < length;) {
+				const ssize_t n = ::pread(file.fd, into + done, length - done, static_cast<off_t>(offset + done));
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0)
+					throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "Error reading " + path.string());
+				done += static_cast<uintmax_t>(n);
+			}
+#else
+			file.stream.clear();
+			file.stream.seekg(static_cast<std::streamoff>(offset));
+			file.stream.read(into, static_cast<std::streamsize>(length));
+			if (static_cast<uintmax_t>(file.stream.gcount()) != length)
+				throw std::runtime_error("Error reading " + path.string());
+#endif
+			co_return;
+		}
+#ifdef __linux__
+		auto &socket = context.socket;
+		if (!socket.native_non_blocking())
+			socket.native_non_blocking(true);
+		auto position = static_cast<off_t>(offset);
+		uintmax_t remaining = length;
+		while (remaining > 0) {
+			// sendfile moves at most ~2GiB per call
+			const ssize_t sent = ::sendfile(socket.native_handle(), file.fd, &position, std::min<uintmax_t>(remaining, 1 << 30));
+			if (sent > 0) {
+				remaining -= sent;
+				context.metrics->bytes_out.add(sent);
+			} else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				co_await socket.async_wait(asio::socket_base::wait_write, asio::use_awaitable);
+			} else if (sent < 0 && errno == EINTR) {
+			} else {
+				// sent == 0 means the file got shorter than `length`
+				throw std::system_error(sent < 0 ? errno : EIO, std::generic_category(), "Error sending " + path.string());
+			}
+		}
+#else
+		auto &stream = file.stream;
+		stream.clear();
+		stream.seekg(static_cast<std::streamoff>(offset));
+		std::array<char, 64 * 1024> buffer;
+		uintmax_t remaining = length;
+		while (remaining > 0) {
+			stream.read(buffer.data(), static_cast<std::streamsize>(std::min<uintmax_t>(remaining, buffer.size())));
+			const auto amount = static_cast<size_t>(stream.gcount());
+			if (amount == 0)
+				throw std::runtime_error("Error reading from " + path.string());
+			const std::array<asio::const_buffer, 1> buffers{asio::buffer(buffer.data(), amount)};
+			co_await write(buffers);
+			remaining -= amount;
+		}
+#endif
+	}
+
 	void Response::add_header(std::string_view key, std::string_view value) {
-		auto found = headers.find(key);
-		if (found == headers.end())
-			headers.emplace(key, std::vector<std::string>{std::string{value}});
-		else
-			found->second.emplace_back(value);
+		headers.add(key, value);
 	}
 	bool Response::has_header(std::string_view key) const {
-		return headers.find(key) != headers.end();
+		return headers.contains(key);
 	}
-	std::vector<std::string> &Response::get_header(std::string_view key) {
-		auto found = headers.find(key);
-		if (found == headers.end())
-			return headers.emplace(key, std::vector<std::string>{}).first->second;
-		else
-			return found->second;
+	std::vector<std::string_view> Response::get_header(std::string_view key) const {
+		std::vector<std::string_view> values;
+		headers.values(key, [&](const std::string_view value) { values.push_back(value); });
+		return values;
 	}
 	bool Response::remove_header(std::string_view key) {
-		auto found = headers.find(key);
-		if (found == headers.end())
-			return false;
-		headers.erase(found);
-		return true;
+		return headers.remove(key) > 0;
 	}
 	bool Response::set_header(std::string_view key, std::string_view value) {
 		bool overwritten = remove_header(key);
 		add_header(key, value);
 		return overwritten;
 	}
-} // namespace ewhttp
\ No newline at end of file
+	bool Response::set_header(std::string_view key, const std::span<const std::string_view> values) {
+		// the values may point into `headers`, which removing would shift
+		std::vector<std::string> owned{values.begin(), values.end()};
+		bool overwritten = remove_header(key);
+		for (const auto &value : owned)
+			add_header(key, value);
+		return overwritten;
+	}
+	void Response::add_headers(const HeaderBlock &block) {
+		headers.add_serialized(block.serialized);
+	}
+} // namespace ewhttp
@@ -1,7 +1,18 @@
 #include <ewhttp/request.h>
 #include <ewhttp/server.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <llhttp.h>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace {
 	using ewhttp::detail::RequestContext;
@@ -10,15 +21,136 @@ namespace {
 	int cb(llhttp_t *parser) {
 		return Callback(*static_cast<RequestContext *>(parser->data));
 	}
+	template<int (*Callback)(RequestContext &, const llhttp_t &)>
+	int parser_cb(llhttp_t *parser) {
+		return Callback(*static_cast<RequestContext *>(parser->data), *parser);
+	}
 	template<int (*Callback)(RequestContext &, std::string_view)>
 	int data_cb(llhttp_t *parser, const char *data, const size_t amount) {
 		return Callback(*static_cast<RequestContext *>(parser->data),
 						std::string_view{data, amount});
 	}
+
+#ifdef SO_REUSEPORT
+	using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+	constexpr bool has_reuse_port = true;
+#else
+	constexpr bool has_reuse_port = false;
+#endif
+
+	asio::ip::tcp::acceptor make_acceptor(asio::io_context &io_context, const asio::ip::tcp::endpoint &endpoint, const bool share_port) {
+		asio::ip::tcp::acceptor acceptor(io_context);
+		acceptor.open(endpoint.protocol());
+		acceptor.set_option(asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+		if (share_port)
+			acceptor.set_option(reuse_port(true));
+#endif
+		acceptor.bind(endpoint);
+		acceptor.listen();
+		// lets accept() drain the backlog after an async_accept, see Server::accept
+		acceptor.non_blocking(true);
+		return acceptor;
+	}
+	// connections taken from the backlog per wakeup, before letting the shard's other work run
+	constexpr size_t accept_batch = 64;
+
+	constexpr size_t initial_read_buffer = 8 * 1024;
+	// request arenas a pooled connection keeps, a busy one grows back to what its pipelining needs
+	constexpr size_t pooled_arenas = 1;
+	constexpr size_t max_read_buffer = 256 * 1024;
+	// don't bother issuing reads smaller than this, switch blocks instead
+	constexpr size_t min_read = 1024;
+
+	// make sure locals.buffer has at least min_read bytes free. blocks still referenced by requests are never written to again.
+	void prepare_read_buffer(RequestContext &locals) {
+		auto &buffer = locals.buffer;
+		if (buffer->data.size() - buffer->used >= min_read)
+			return;
+		if (buffer.use_count() == 1) {
+			// nobody is looking at it, start over
+			buffer->used = 0;
+			return;
+		}
+		// a request straddling the end of the block (its headers, or a body streaming through) means the block was too small for it.
+		// not judged by locals.request, which is handed to its handler once the headers are complete.
+		const bool straddling = locals.phase != RequestContext::Phase::idle;
+		const size_t size = straddling ? std::min(buffer->data.size() * 2, max_read_buffer) : buffer->data.size();
+		std::swap(buffer, locals.spare);
+		if (!buffer || buffer.use_count() > 1 || buffer->data.size() < size)
+			buffer = std::make_shared<ewhttp::detail::ReadBuffer>(size);
+		buffer->used = 0;
+	}
+
+	asio::steady_timer::time_point deadline_after(const std::chrono::milliseconds timeout) {
+		return timeout.count() > 0 ? asio::steady_timer::clock_type::now() + timeout : asio::steady_timer::time_point::max();
+	}
+	// when the next read has to be done by, judging by what it's waiting for
+	asio::steady_timer::time_point read_deadline(const RequestContext &locals) {
+		switch (locals.phase) {
+			case RequestContext::Phase::idle:
+				return deadline_after(locals.options.idle_timeout);
+			case RequestContext::Phase::headers:
+				return locals.headers_deadline;
+			case RequestContext::Phase::body:
+				return deadline_after(locals.options.body_timeout);
+		}
+		return asio::steady_timer::time_point::max();
+	}
+
+	// refuse the request being parsed. returned from llhttp callbacks, which stops the parser.
+	int refuse(RequestContext &locals, const ewhttp::StatusT status) {
+		locals.rejection = status;
+		return -1;
+	}
+	// answer a refused request. it never reached a handler, so this is written directly.
+	asio::awaitable<void> send_rejection(RequestContext &locals) {
+		const auto status_line = ewhttp::detail::status_line(*locals.rejection);
+		constexpr std::string_view headers = "Connection: close\r\nContent-Length: 0\r\n\r\n";
+		const std::array<asio::const_buffer, 2> buffers{asio::buffer(status_line.data(), status_line.size()), asio::buffer(headers.data(), headers.size())};
+		asio::error_code ec;
+		co_await asio::async_write(locals.socket, buffers, asio::redirect_error(asio::use_awaitable, ec));
+	}
+
+	// counts a connection for as long as it's open
+	struct ConnectionSlot {
+		std::atomic<size_t> &count;
+		explicit ConnectionSlot(std::atomic<size_t> &count) : count{count} {}
+		ConnectionSlot(const ConnectionSlot &) = delete;
+		~ConnectionSlot() { count.fetch_sub(1, std::memory_order_relaxed); }
+	};
+
+	// cores this process may run on (taskset, cgroups), empty if that's unknown
+	std::vector<int> allowed_cores() {
+		std::vector<int> cores;
+#ifdef __linux__
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+			std::cerr << "[EWHTTP]: Couldn't get the allowed cores, threads aren't pinned: " << std::strerror(errno) << '\n';
+			return cores;
+		}
+		for (int core = 0; core < CPU_SETSIZE; core++)
+			if (CPU_ISSET(core, &allowed))
+				cores.push_back(core);
+#endif
+		return cores;
+	}
+
+	void pin_to_core([[maybe_unused]] const int core) {
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		if (const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); error != 0)
+			std::cerr << "[EWHTTP]: Couldn't pin a thread to core " << core << ": " << std::strerror(error) << '\n';
+#endif
+	}
 } // namespace
 
 asio::awaitable<void>
-ewhttp::Server::respond(asio::ip::tcp::socket socket_param) {
+ewhttp::Server::respond(detail::Shard &shard, asio::ip::tcp::socket socket_param) {
+	const ConnectionSlot slot{connections};
 	llhttp_t parser;
 	llhttp_settings_t settings;
 	llhttp_settings_init(&settings);
@@ -36,26 +168,63 @@ ewhttp::Server::respond(asio::ip::tcp::socket socket_param) {
 			}>;
 
 	settings.on_url = data_cb<[](RequestContext &locals, std::string_view data) {
-		locals.request.path += data;
+		locals.request.append(locals.request.path, data, locals.buffer);
+		if (locals.options.max_url_length < locals.request.path.size())
+			return refuse(locals, Status::URITooLong);
+		return 0;
+	}>;
+
+	settings.on_url_complete = cb<[](RequestContext &locals) {
+		// the router and everything else after it match on the path alone
+		auto &request = locals.request;
+		const auto target = request.path;
+		const auto fragment = target.find('#');
+		const auto question = target.find('?');
+		if (question < fragment) {
+			request.path = target.substr(0, question);
+			request.query = target.substr(question + 1, fragment == std::string_view::npos ? std::string_view::npos : fragment - question - 1);
+		} else {
+			request.path = target.substr(0, fragment);
+		}
 		return 0;
 	}>;
 
 	settings.on_header_field =
 			data_cb<[](RequestContext &locals, std::string_view data) {
 				auto &request = locals.request;
-				if (request.headers.empty() || !request.headers.back().second.empty())
-					request.headers.emplace_back(data, "");
-				else
-					request.headers.back().first += data;
+				// a value (even an empty one) was parsed, so this is the next header rather than more of the last name
+				if (request.headers.empty() || request.headers.back().second.data() != nullptr) {
+					if (request.headers.size() >= locals.options.max_headers)
+						return refuse(locals, Status::RequestHeaderFieldsTooLarge);
+					request.headers.emplace_back();
+				}
+				if (locals.options.max_header_bytes < (locals.header_bytes += data.size()))
+					return refuse(locals, Status::RequestHeaderFieldsTooLarge);
+				request.append(request.headers.back().first, data, locals.buffer);
 				return 0;
 			}>;
 
+	settings.on_header_field_complete = cb<[](RequestContext &locals) {
+		locals.request.index_header();
+		return 0;
+	}>;
+
 	settings.on_header_value =
 			data_cb<[](RequestContext &locals, std::string_view data) {
-				locals.request.headers.back().second += data;
+				auto &request = locals.request;
+				if (locals.options.max_header_bytes < (locals.header_bytes += data.size()))
+					return refuse(locals, Status::RequestHeaderFieldsTooLarge);
+				request.append(request.headers.back().second, data, locals.buffer);
 				return 0;
 			}>;
 
+	settings.on_header_value_complete = cb<[](RequestContext &locals) {
+		auto &[name, value] = locals.request.headers.back();
+		if (value.data() == nullptr)
+			value = {name.data() + name.size(), 0};
+		return 0;
+	}>;
+
 	settings.on_method_complete = cb<[](RequestContext &locals) {
 		if (const auto method = Method::from_string(locals.method)) {
 			locals.request.method = *method;
@@ -67,67 +236,339 @@ ewhttp::Server::respond(asio::ip::tcp::socket socket_param) {
 		return 0;
 	}>;
 
-	settings.on_headers_complete = cb<[](RequestContext &locals) {
+	settings.on_message_begin = cb<[](RequestContext &locals) {
+		locals.phase = RequestContext::Phase::headers;
+		locals.headers_deadline = deadline_after(locals.options.header_timeout);
+		locals.header_bytes = 0;
+		// too many requests in flight, stop parsing until one finishes
+		if (locals.in_flight() >= locals.max_pipelined)
+			return static_cast<int>(HPE_PAUSED);
+		return 0;
+	}>;
+
+	settings.on_body = data_cb<[](RequestContext &locals, std::string_view data) {
+		auto &body = locals.body;
+		// past the limit without a Content-Length to refuse it by. its handler already runs, so just end the connection.
+		if (locals.options.max_body_bytes && locals.options.max_body_bytes < (locals.body_bytes += data.size()))
+			return -1;
+		if (body.discard)
+			return 0;
+		body.chunk = data;
+		body.state = body.ready;
+		locals.notify();
+		return static_cast<int>(HPE_PAUSED);
+	}>;
+
+	settings.on_message_complete = cb<[](RequestContext &locals) {
+		locals.phase = RequestContext::Phase::idle;
+		locals.body.complete = true;
+		locals.notify();
+		return 0;
+	}>;
+
+	settings.on_headers_complete = parser_cb<[](RequestContext &locals, const llhttp_t &parser) {
+		locals.phase = RequestContext::Phase::body;
+		// llhttp decides this before calling us, the handler below may already want to know
+		if (parser.upgrade)
+			locals.upgrade.requested = true;
+		locals.body_bytes = 0;
+		if (locals.options.max_body_bytes)
+			// llhttp refuses conflicting Content-Lengths, so the first one is the one
+			if (const auto value = locals.request.header(KnownHeader::content_length)) {
+				size_t length = 0;
+				std::from_chars(value->data(), value->data() + value->size(), length);
+				if (locals.options.max_body_bytes < length)
+					return refuse(locals, Status::ContentTooLarge); // -1, not 1 (which would mean "no body")
+			}
+		locals.body = {};
+		locals.body.sequence = locals.request.sequence = locals.requests_started;
+		// take the request out right now, the parser continues with the next one while this one is handled
 		asio::co_spawn(
 				locals.executor,
-				[&]() -> async {
-					Request request = std::move(locals.request);
-					locals.request = Request{{255}, &locals};
-					Response response{locals};
-					co_await locals.callback(request, response);
-					if (!response.headers_sent) {
-						std::cerr << "[EWHTTP]: Nothing Sent?\n";
+				[](RequestContext &locals, Request request, const size_t sequence) -> async {
+					const auto start = std::chrono::steady_clock::now();
+					Response response{locals, sequence};
+					response.omit_body = request.method == Method::HEAD;
+					bool threw = false;
+					try {
+						co_await locals.callback(request, response);
+						if (!response.headers_sent) {
+							std::cerr << "[EWHTTP]: Nothing Sent?\n";
+						}
+					} catch (const std::exception &e) {
+						std::cerr << "[EWHTTP]: Handler threw: " << e.what() << '\n';
+						locals.metrics->handler_exceptions.add();
+						threw = true;
 					}
-					co_return;
-				},
+					// the handler is done with its slot, even if requests ahead of it are still being written
+					response.release_admissions();
+					if (locals.body.sequence == sequence && !locals.body.complete) {
+						// unread body, skip over it
+						locals.body.discard = true;
+						locals.body.state = locals.body.parsing;
+					}
+					locals.metrics->record(response, request.method, std::chrono::steady_clock::now() - start);
+					// finished before a request pipelined ahead of it (it threw, or never wrote): let that one go first, so responses stay in order
+					while (locals.responses_done != sequence)
+						co_await locals.wait();
+					if (response.writer_open) {
+						std::cerr << "[EWHTTP]: Handler returned without finishing its BodyWriter\n";
+						threw = true;
+					}
+					if (threw) {
+						// a half-written response would desync every response after it
+						asio::error_code ec;
+						locals.socket.close(ec);
+					}
+					locals.responses_done++;
+					locals.notify();
+				}(locals, std::exchange(locals.request, Request{{255}, &locals}), locals.requests_started++),
 				asio::detached);
 		return 0;
 	}>;
 
 	llhttp_init(&parser, HTTP_REQUEST, &settings);
-	RequestContext locals{Request{{255}, &locals}, callback, "",
-						  std::move(socket_param), io_executor};
+	// the state of an earlier connection if there is one, with its buffers already allocated
+	std::unique_ptr<RequestContext> context;
+	if (shard.free_contexts.empty()) {
+		context = std::make_unique<RequestContext>(callback, std::move(socket_param), shard.io_executor, options);
+	} else {
+		context = std::move(shard.free_contexts.back());
+		shard.free_contexts.pop_back();
+		context->reuse(std::move(socket_param), shard.io_executor);
+	}
+	auto &locals = *context;
 	parser.data = &locals;
+	locals.metrics->connections_opened.add();
 	auto &socket = locals.socket;
+	{
+		asio::error_code ec;
+		locals.remote = socket.remote_endpoint(ec).address();
+	}
+	locals.watching = true;
+	asio::co_spawn(socket.get_executor(), locals.watch_deadline(), asio::detached);
 
 	for (;;) {
-		char data_buf[1024];
-		std::size_t n = co_await socket.async_read_some(asio::buffer(data_buf),
-														asio::use_awaitable);
-		std::string_view data{data_buf, n};
-		if (auto result = llhttp_execute(&parser, data.data(), data.length());
-			result == HPE_OK) {
-		} else if (result == HPE_PAUSED_UPGRADE) {
-			llhttp_resume_after_upgrade(&parser); // ignore upgrade
-		} else if (result != HPE_PAUSED) {
+		prepare_read_buffer(locals);
+		auto &buffer = *locals.buffer;
+		asio::error_code ec;
+		locals.deadline.expires_at(read_deadline(locals));
+		std::size_t n = co_await socket.async_read_some(asio::buffer(buffer.data.data() + buffer.used, buffer.data.size() - buffer.used),
+														asio::redirect_error(asio::use_awaitable, ec));
+		locals.deadline.expires_at(asio::steady_timer::time_point::max());
+		if (ec) break;
+		locals.metrics->bytes_in.add(n);
+		std::string_view data{buffer.data.data() + buffer.used, n};
+		buffer.used += n;
+		auto result = llhttp_execute(&parser, data.data(), data.length());
+		while (result == HPE_PAUSED || result == HPE_PAUSED_UPGRADE) {
+			const char *pos = llhttp_get_error_pos(&parser);
+			if (result == HPE_PAUSED_UPGRADE) {
+				// the request before `pos` asked for another protocol. its handler decides whether the connection switches.
+				const auto sequence = locals.requests_started - 1;
+				locals.upgrade.paused = true;
+				locals.upgrade.data = {pos, static_cast<size_t>(data.data() + data.size() - pos)};
+				locals.notify();
+				while (!locals.upgrade.accepted && locals.responses_done <= sequence)
+					co_await locals.wait();
+				if (locals.upgrade.accepted)
+					break; // the socket is gone, handed to the handler
+				// answered with plain HTTP, carry on with what came after it
+				locals.upgrade = {};
+				llhttp_resume_after_upgrade(&parser);
+			} else {
+				// paused by on_message_begin or on_body, continue where it left off once there's room and the body chunk was consumed
+				if (locals.in_flight() >= locals.max_pipelined || locals.body.state != locals.body.parsing) {
+					do
+						co_await locals.wait();
+					while (locals.in_flight() >= locals.max_pipelined || locals.body.state != locals.body.parsing);
+					// the wait was on us, not the client
+					if (locals.phase == RequestContext::Phase::headers)
+						locals.headers_deadline = deadline_after(options.header_timeout);
+				}
+				llhttp_resume(&parser);
+			}
+			result = llhttp_execute(&parser, pos, data.data() + data.size() - pos);
+		}
+		if (locals.upgrade.accepted)
+			break;
+		if (result != HPE_OK) {
+			locals.metrics->parse_error(result);
 			break;
 		}
 	}
+	// handlers still reference locals. let body readers see the end of the (truncated) body, then wait for them.
+	locals.body.complete = true;
+	locals.body.state = locals.body.parsing;
+	locals.upgrade.requested = false;
+	locals.notify();
+	while (locals.in_flight() > 0)
+		co_await locals.wait();
+	if (locals.rejection)
+		co_await send_rejection(locals);
+	// stop the deadline watcher, it references locals too
+	asio::error_code ec;
+	socket.close(ec);
+	locals.deadline.expires_at(asio::steady_timer::time_point::max());
+	while (locals.watching)
+		co_await locals.wait();
+	locals.metrics->connections_closed.add();
+	locals.release();
+	if (shard.free_contexts.size() < options.pooled_connections)
+		shard.free_contexts.push_back(std::move(context));
 }
 
+namespace ewhttp::detail {
+	RequestContext::RequestContext(server_callback &callback, asio::ip::tcp::socket socket, asio::any_io_executor executor, const ServerOptions &options)
+		: request{{255}, this}, callback{callback}, socket{std::move(socket)}, executor{std::move(executor)},
+		  buffer{std::make_shared<ReadBuffer>(initial_read_buffer)}, max_pipelined{std::max<size_t>(options.max_pipelined, 1)}, options{options},
+		  notifier{this->socket.get_executor(), asio::steady_timer::time_point::max()}, deadline{this->socket.get_executor(), asio::steady_timer::time_point::max()}, metrics{&thread_metrics()} {}
+
+	void RequestContext::reuse(asio::ip::tcp::socket new_socket, asio::any_io_executor new_executor) {
+		socket = std::move(new_socket);
+		executor = std::move(new_executor);
+		// the shard may run on a different thread than last time
+		metrics = &thread_metrics();
+	}
+
+	void RequestContext::release() {
+		// back to how a new context starts out, minus the allocations
+		request = Request{{255}, this};
+		if (free_arenas.size() > pooled_arenas)
+			free_arenas.resize(pooled_arenas);
+		method.clear();
+		body = {};
+		requests_started = responses_done = 0;
+		phase = Phase::idle;
+		header_bytes = body_bytes = 0;
+		rejection.reset();
+		upgrade = {};
+		if (buffer.use_count() == 1)
+			buffer->used = 0;
+		else
+			buffer = std::make_shared<ReadBuffer>(initial_read_buffer);
+		spare.reset();
+		// a pooled context mustn't keep its shard running
+		executor = asio::any_io_executor{};
+	}
+
+	async RequestContext::wait() {
+		asio::error_code ec;
+		co_await notifier.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+	}
+
+	async RequestContext::watch_deadline() {
+		while (socket.is_open()) {
+			asio::error_code ec;
+			co_await deadline.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+			if (deadline.expiry() > asio::steady_timer::clock_type::now())
+				continue; // moved by the next read
+			if (phase == Phase::idle && in_flight() > 0) {
+				// the client is waiting for a response, not the other way around
+				deadline.expires_after(options.idle_timeout);
+				continue;
+			}
+			// a request that's partway through its headers gets a 408, anything else is just closed
+			if (phase == Phase::headers)
+				rejection = Status::RequestTimeout;
+			deadline.expires_at(asio::steady_timer::time_point::max());
+			socket.cancel(ec);
+		}
+		watching = false;
+		notify();
+	}
+} // namespace ewhttp::detail
+
 namespace ewhttp {
-	void Server::run(const asio::ip::address host, const uint16_t port) {
-		auto &executor = io_executor = asio::require(
-				io_context.get_executor(), asio::execution::outstanding_work_t::tracked);
-		co_spawn(
-				io_context,
-				[this](asio::any_io_executor &executor, const asio::ip::address host, const uint16_t port) -> asio::awaitable<void> {
-					asio::ip::tcp::acceptor acceptor(executor, {host, port});
-					for (;;) {
-						asio::ip::tcp::socket socket =
-								co_await acceptor.async_accept(asio::use_awaitable);
-						asio::co_spawn(executor, respond(std::move(socket)), asio::detached);
-					}
-				}(executor, host, port),
-				asio::detached);
+	async Server::accept(detail::Shard &shard, const bool distribute) {
+		size_t next = 0;
+		asio::steady_timer throttle{shard.io_context};
+		for (;;) {
+			// at the connection limit, leave new connections in the listen backlog for a bit
+			while (options.max_connections && connections.load(std::memory_order_relaxed) >= options.max_connections) {
+				asio::error_code ec;
+				throttle.expires_after(std::chrono::milliseconds{10});
+				co_await throttle.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				if (!shard.acceptor->is_open())
+					co_return; // stopped
+			}
+			auto *target = distribute ? shards[next % shards.size()].get() : &shard;
+			asio::error_code ec;
+			asio::ip::tcp::socket socket =
+					co_await shard.acceptor->async_accept(target->io_context, asio::redirect_error(asio::use_awaitable, ec));
+			if (ec == asio::error::operation_aborted || !shard.acceptor->is_open())
+				co_return; // stopped
+			if (ec)
+				continue;
+			// then take whatever else is already in the backlog without another trip through epoll/io_uring, like a multishot accept
+			for (size_t accepted = 1;; accepted++) {
+				next++;
+				connections.fetch_add(1, std::memory_order_relaxed);
+				asio::co_spawn(target->io_context, respond(*target, std::move(socket)), asio::detached);
+				if (accepted == accept_batch || (options.max_connections && connections.load(std::memory_order_relaxed) >= options.max_connections))
+					break;
+				target = distribute ? shards[next % shards.size()].get() : &shard;
+				socket = shard.acceptor->accept(target->io_context, ec); // non-blocking, would_block once the backlog is empty
+				if (ec)
+					break;
+			}
+		}
+	}
 
-		io_context.run();
+	void Server::run(const asio::ip::address host, const uint16_t port) {
+		run(host, port, 1);
 	}
 	void Server::run(const std::string_view host, const uint16_t port) {
-		run(asio::ip::make_address(host), port);
+		run(asio::ip::make_address(host), port, 1);
+	}
+
+	void Server::run(const asio::ip::address host, const uint16_t port, unsigned int threads) {
+		if (threads == 0) threads = 1;
+		while (shards.size() < threads)
+			shards.emplace_back(std::make_unique<detail::Shard>());
+		const asio::ip::tcp::endpoint endpoint{host, port};
+		// without SO_REUSEPORT only one acceptor can own the port, so shard 0 distributes connections itself
+		const bool share_port = has_reuse_port && threads > 1;
+		for (unsigned int i = 0; i < threads; i++) {
+			auto &shard = *shards[i];
+			shard.io_context.restart();
+			shard.io_executor = asio::require(
+					shard.io_context.get_executor(), asio::execution::outstanding_work_t::tracked);
+			if (i == 0 || share_port) {
+				shard.acceptor.emplace(make_acceptor(shard.io_context, endpoint, share_port));
+				co_spawn(shard.io_context, accept(shard, !share_port && threads > 1), asio::detached);
+			}
+		}
+
+		// opt-in: the calling thread runs shard 0, and pinning it outlives run()
+		const auto cores = options.pin_threads && threads > 1 ? allowed_cores() : std::vector<int>{};
+		std::vector<std::jthread> workers;
+		workers.reserve(threads - 1);
+		for (unsigned int i = 1; i < threads; i++)
+			workers.emplace_back([this, i, core = cores.empty() ? -1 : cores[i % cores.size()]] {
+				if (core >= 0) pin_to_core(core);
+				shards[i]->io_context.run();
+			});
+		if (!cores.empty()) pin_to_core(cores[0]);
+		shards[0]->io_context.run();
+		// workers join on destruction
+	}
+	void Server::run(const std::string_view host, const uint16_t port, const unsigned int threads) {
+		run(asio::ip::make_address(host), port, threads);
 	}
 
-	void Server::force_stop() { io_context.stop(); }
+	void Server::force_stop() {
+		for (auto &shard : shards)
+			shard->io_context.stop();
+	}
 
-	void Server::stop() { io_executor = asio::any_io_executor{}; }
-} // namespace ewhttp
\ No newline at end of file
+	void Server::stop() {
+		for (auto &owned : shards)
+			asio::post(owned->io_context, [this, &shard = *owned] {
+				if (shard.acceptor) shard.acceptor->close();
+				shard.io_executor = asio::any_io_executor{};
+				if (&shard == shards.front().get() && signals)
+					signals->cancel();
+			});
+	}
+} // namespace ewhttp
@@ -0,0 +1,510 @@
+#include <ewhttp/server.h>
+#include <ewhttp/websocket.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+
+namespace ewhttp::websocket {
+	namespace {
+		constexpr std::string_view handshake_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+		// room past max_message_size for the header of the frame being read and a control frame after it
+		constexpr size_t buffer_slack = 256;
+		// frames gathered into one write
+		constexpr size_t max_write_batch = 64;
+
+		// SHA-1, only for Sec-WebSocket-Accept
+		std::array<uint8_t, 20> sha1(const std::string_view input) {
+			std::array<uint32_t, 5> h{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+			std::string message{input};
+			message += static_cast<char>(0x80);
+			while (message.size() % 64 != 56) message += '\0';
+			const uint64_t bits = static_cast<uint64_t>(input.size()) * 8;
+			for (int shift = 56; shift >= 0; shift -= 8) message += static_cast<char>(bits >> shift);
+
+			for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+				std::array<uint32_t, 80> w;
+				for (size_t i = 0; i < 16; i++) {
+					const auto *bytes = reinterpret_cast<const uint8_t *>(message.data() + chunk + i * 4);
+					w[i] = static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 | static_cast<uint32_t>(bytes[2]) << 8 | bytes[3];
+				}
+				for (size_t i = 16; i < 80; i++) w[i] = std::rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+				auto [a, b, c, d, e] = h;
+				for (size_t i = 0; i < 80; i++) {
+					uint32_t f, k;
+					if (i < 20) f = (b & c) | (~b & d), k = 0x5A827999;
+					else if (i < 40) f = b ^ c ^ d, k = 0x6ED9EBA1;
+					else if (i < 60) f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+					else f = b ^ c ^ d, k = 0xCA62C1D6;
+					const uint32_t temp = std::rotl(a, 5) + f + e + k + w[i];
+					e = d;
+					d = c;
+					c = std::rotl(b, 30);
+					b = a;
+					a = temp;
+				}
+				h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+			}
+			std::array<uint8_t, 20> digest;
+			for (size_t i = 0; i < 20; i++) digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - i % 4 * 8));
+			return digest;
+		}
+
+		std::string base64(const std::span<const uint8_t> data) {
+			constexpr std::string_view alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+			std::string result;
+			for (size_t i = 0; i < data.size(); i += 3) {
+				const uint32_t group = static_cast<uint32_t>(data[i]) << 16 | (i + 1 < data.size() ? data[i + 1] << 8 : 0) | (i + 2 < data.size() ? data[i + 2] : 0);
+				result += alphabet[group >> 18 & 63];
+				result += alphabet[group >> 12 & 63];
+				result += i + 1 < data.size() ? alphabet[group >> 6 & 63] : '=';
+				result += i + 2 < data.size() ? alphabet[group & 63] : '=';
+			}
+			return result;
+		}
+
+		// whether the comma separated header `value` has `token`, ignoring case
+		bool has_token(std::string_view value, const std::string_view token) {
+			while (!value.empty()) {
+				const auto comma = value.find(',');
+				auto item = value.substr(0, comma);
+				while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+				while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+				if (ewhttp::detail::iequals(item, token)) return true;
+				if (comma == std::string_view::npos) break;
+				value.remove_prefix(comma + 1);
+			}
+			return false;
+		}
+
+		std::string_view find_header(const Request &request, const KnownHeader name) {
+			return request.header(name).value_or(std::string_view{});
+		}
+
+		struct IncomingHeader {
+			bool fin, reserved, masked;
+			Opcode opcode;
+			std::array<uint8_t, 4> mask;
+			uint64_t payload_size;
+			// bytes of the header itself
+			size_t size;
+		};
+		// std::nullopt if not all of the header arrived yet
+		std::optional<IncomingHeader> parse_header(const std::span<const char> data) {
+			if (data.size() < 2) return std::nullopt;
+			const auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+			IncomingHeader header{
+					.fin = (bytes[0] & 0x80) != 0,
+					.reserved = (bytes[0] & 0x70) != 0, // no extensions are negotiated
+					.masked = (bytes[1] & 0x80) != 0,
+					.opcode = static_cast<Opcode>(bytes[0] & 0x0F),
+					.mask = {},
+					.payload_size = bytes[1] & 0x7Fu,
+					.size = 2,
+			};
+			if (header.payload_size >= 126) {
+				const size_t length_size = header.payload_size == 126 ? 2 : 8;
+				if (data.size() < 2 + length_size) return std::nullopt;
+				header.payload_size = 0;
+				for (size_t i = 0; i < length_size; i++) header.payload_size = header.payload_size << 8 | bytes[2 + i];
+				header.size += length_size;
+			}
+			if (header.masked) {
+				if (data.size() < header.size + 4) return std::nullopt;
+				std::memcpy(header.mask.data(), bytes + header.size, 4);
+				header.size += 4;
+			}
+			return header;
+		}
+
+		// UTF-8 as RFC 3629 has it: no overlong forms, surrogates or code points past U+10FFFF
+		bool valid_utf8(const std::string_view text) {
+			const auto *bytes = reinterpret_cast<const uint8_t *>(text.data());
+			const size_t size = text.size();
+			size_t i = 0;
+			while (i < size) {
+				// ascii a word at a time
+				if (i + sizeof(uint64_t) <= size) {
+					uint64_t word;
+					std::memcpy(&word, bytes + i, sizeof(word));
+					if ((word & 0x8080808080808080ull) == 0) {
+						i += sizeof(word);
+						continue;
+					}
+				}
+				const uint8_t lead = bytes[i];
+				if (lead < 0x80) {
+					i++;
+					continue;
+				}
+				// length of the sequence, and the range its second byte has to be in
+				size_t length = 0;
+				uint8_t low = 0x80, high = 0xBF;
+				if (lead >= 0xC2 && lead <= 0xDF) length = 2;
+				else if (lead == 0xE0) length = 3, low = 0xA0;
+				else if (lead == 0xED) length = 3, high = 0x9F; // no surrogates
+				else if (lead >= 0xE1 && lead <= 0xEF) length = 3;
+				else if (lead == 0xF0) length = 4, low = 0x90;
+				else if (lead >= 0xF1 && lead <= 0xF3) length = 4;
+				else if (lead == 0xF4) length = 4, high = 0x8F;
+				else return false;
+				if (size - i < length || bytes[i + 1] < low || bytes[i + 1] > high)
+					return false;
+				for (size_t j = 2; j < length; j++)
+					if ((bytes[i + j] & 0xC0) != 0x80) return false;
+				i += length;
+			}
+			return true;
+		}
+
+		// codes a peer may send (RFC 6455 7.4). 1005, 1006 and 1015 are only for reporting locally.
+		bool valid_close_code(const uint16_t code) {
+			if (code >= 3000 && code <= 4999) return true;
+			return code >= 1000 && code <= 1014 && code != 1004 && code != 1005 && code != 1006;
+		}
+
+		bool is_control(const Opcode opcode) { return (static_cast<uint8_t>(opcode) & 0x8) != 0; }
+		bool is_known(const Opcode opcode) {
+			switch (opcode) {
+				case Opcode::continuation:
+				case Opcode::text:
+				case Opcode::binary:
+				case Opcode::close:
+				case Opcode::ping:
+				case Opcode::pong:
+					return true;
+			}
+			return false;
+		}
+	} // namespace
+
+	namespace detail {
+		FrameHeader::FrameHeader(const Opcode opcode, const size_t payload_size, const bool fin) : bytes{} {
+			bytes[0] = static_cast<char>((fin ? 0x80 : 0) | static_cast<uint8_t>(opcode));
+			if (payload_size < 126) {
+				bytes[1] = static_cast<char>(payload_size);
+				size = 2;
+			} else if (payload_size <= 0xFFFF) {
+				bytes[1] = 126;
+				bytes[2] = static_cast<char>(payload_size >> 8);
+				bytes[3] = static_cast<char>(payload_size);
+				size = 4;
+			} else {
+				bytes[1] = 127;
+				for (size_t i = 0; i < 8; i++) bytes[2 + i] = static_cast<char>(static_cast<uint64_t>(payload_size) >> (56 - i * 8));
+				size = 10;
+			}
+		}
+
+		void unmask(const std::span<char> data, const std::array<uint8_t, 4> mask) {
+			std::array<uint8_t, 8> wide;
+			for (size_t i = 0; i < wide.size(); i++) wide[i] = mask[i % 4];
+			uint64_t word;
+			std::memcpy(&word, wide.data(), sizeof(word));
+			size_t i = 0;
+			for (; i + sizeof(word) <= data.size(); i += sizeof(word)) {
+				uint64_t chunk;
+				std::memcpy(&chunk, data.data() + i, sizeof(chunk));
+				chunk ^= word;
+				std::memcpy(data.data() + i, &chunk, sizeof(chunk));
+			}
+			for (; i < data.size(); i++) data[i] = static_cast<char>(data[i] ^ wide[i % 4]);
+		}
+	} // namespace detail
+
+	Frame::Frame(const Opcode opcode, const std::string_view payload) {
+		const detail::FrameHeader header{opcode, payload.size()};
+		encoded = std::make_shared<const Encoded>(header.bytes, header.size, std::string{payload});
+	}
+
+	Session::Session(asio::ip::tcp::socket socket, const Options &options, const std::string_view already_read)
+		: socket{std::move(socket)}, options{options}, buffer(std::max<size_t>(16 * 1024, already_read.size())), end{already_read.size()},
+		  notifier{this->socket.get_executor(), asio::steady_timer::time_point::max()}, ping_timer{this->socket.get_executor()} {
+		std::ranges::copy(already_read, buffer.begin());
+	}
+
+	awaitable<std::shared_ptr<Session>> Session::accept(Req request, Res response, const Options &options) {
+		auto &context = *request.context;
+		const auto key = find_header(request, KnownHeader::sec_websocket_key);
+		// llhttp only flags requests with both `Connection: upgrade` and an Upgrade header, and stops after this one if it's flagged
+		const bool upgrading = context.upgrade.requested && request.sequence + 1 == context.requests_started;
+		if (request.method != Method::GET || !upgrading || !has_token(find_header(request, KnownHeader::upgrade), "websocket") || key.empty()) {
+			response.status = Status::BadRequest;
+			co_await response.send_body(std::string_view{});
+			co_return nullptr;
+		}
+		if (find_header(request, KnownHeader::sec_websocket_version) != "13") {
+			response.status = Status::UpgradeRequired;
+			response.add_header("Sec-WebSocket-Version", "13");
+			co_await response.send_body(std::string_view{});
+			co_return nullptr;
+		}
+
+		std::string accept_input{key};
+		accept_input += handshake_guid;
+		const auto digest = sha1(accept_input);
+		response.status = Status::SwitchingProtocols;
+		response.add_header("Upgrade", "websocket");
+		response.add_header("Connection", "Upgrade");
+		response.add_header("Sec-WebSocket-Accept", base64(digest));
+		co_await response.send_headers();
+		response.body_sent = true;
+
+		// the bytes after the request are only known once the parser gets to its end
+		while (context.upgrade.requested && !context.upgrade.paused)
+			co_await context.wait();
+		if (!context.upgrade.paused)
+			co_return nullptr; // the connection ended first
+		auto session = std::make_shared<Session>(std::move(context.socket), options, context.upgrade.data);
+		// the connection stops reading HTTP
+		context.upgrade.accepted = true;
+		context.notify();
+		// a session can last for hours, it doesn't count as a request in flight
+		response.release_admissions();
+		if (options.ping_interval.count() > 0)
+			asio::co_spawn(session->socket.get_executor(), keepalive(session), asio::detached);
+		co_return session;
+	}
+
+	async Session::wait() {
+		asio::error_code ec;
+		co_await notifier.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+	}
+
+	size_t Session::enqueue(Outgoing frame) {
+		outgoing.push_back(std::move(frame));
+		if (!writing) {
+			writing = true;
+			asio::co_spawn(socket.get_executor(), write_queue(shared_from_this()), asio::detached);
+		}
+		return ++queued;
+	}
+
+	async Session::write_queue(const std::shared_ptr<Session> self) {
+		auto &outgoing = self->outgoing;
+		std::vector<asio::const_buffer> buffers;
+		while (!outgoing.empty() && self->socket.is_open()) {
+			// everything that queued up meanwhile in one write. deque elements stay put while more are pushed.
+			const size_t batch = std::min(outgoing.size(), max_write_batch);
+			buffers.clear();
+			for (size_t i = 0; i < batch; i++) {
+				buffers.push_back(asio::buffer(outgoing[i].header.data(), outgoing[i].header_size));
+				if (!outgoing[i].payload.empty())
+					buffers.push_back(asio::buffer(outgoing[i].payload.data(), outgoing[i].payload.size()));
+			}
+			asio::error_code ec;
+			co_await asio::async_write(self->socket, buffers, asio::redirect_error(asio::use_awaitable, ec));
+			outgoing.erase(outgoing.begin(), outgoing.begin() + static_cast<ptrdiff_t>(batch));
+			self->written += batch;
+			if (ec) self->socket.close(ec);
+			self->notify();
+		}
+		if (!self->socket.is_open()) {
+			// nobody will write these, let their senders go
+			outgoing.clear();
+			self->written = self->queued;
+		}
+		self->writing = false;
+		self->notify();
+	}
+
+	async Session::keepalive(const std::weak_ptr<Session> weak) {
+		for (;;) {
+			asio::steady_timer *timer;
+			{
+				const auto self = weak.lock();
+				if (!self || !self->socket.is_open()) co_return;
+				self->ping_timer.expires_after(self->options.ping_interval);
+				timer = &self->ping_timer;
+			}
+			// not holding the session while waiting. if it's destroyed meanwhile, the timer goes with it and the wait ends.
+			asio::error_code ec;
+			co_await timer->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+			const auto self = weak.lock();
+			if (!self || !self->socket.is_open()) co_return;
+			if (!self->received_since_ping) {
+				// no pong (or anything else) since the last ping
+				self->socket.close(ec);
+				self->notify();
+				co_return;
+			}
+			self->received_since_ping = false;
+			if (!self->close_sent) {
+				const detail::FrameHeader header{Opcode::ping, 0};
+				self->enqueue({header.bytes, header.size, {}, nullptr});
+			}
+		}
+	}
+
+	awaitable<bool> Session::read_more(size_t &message_start, const size_t message_size, size_t &position) {
+		if (end == buffer.size()) {
+			// close the gaps the headers of earlier fragments left, and drop everything before the message
+			const size_t gap = position - (message_start + message_size);
+			std::memmove(buffer.data() + message_start + message_size, buffer.data() + position, end - position);
+			end -= gap;
+			position -= gap;
+			std::memmove(buffer.data(), buffer.data() + message_start, end - message_start);
+			end -= message_start;
+			position -= message_start;
+			message_start = begin = 0;
+			if (end == buffer.size()) {
+				const size_t limit = options.max_message_size + buffer_slack;
+				if (buffer.size() >= limit) {
+					co_await close(close_code::too_big);
+					co_return false;
+				}
+				buffer.resize(std::min(buffer.size() * 2, limit));
+			}
+		}
+		asio::error_code ec;
+		const auto n = co_await socket.async_read_some(asio::buffer(buffer.data() + end, buffer.size() - end), asio::redirect_error(asio::use_awaitable, ec));
+		if (ec) {
+			socket.close(ec);
+			notify();
+			co_return false;
+		}
+		end += n;
+		co_return true;
+	}
+
+	awaitopt<Message> Session::receive() {
+		begin += returned;
+		returned = 0;
+		if (begin == end) begin = end = 0;
+		// the message so far is [message_start, message_start + message_size), the next frame starts at `position`.
+		// fragments after the first are moved back to follow it, so the whole message ends up contiguous.
+		size_t message_start = begin, message_size = 0, position = begin;
+		std::optional<Opcode> message_opcode;
+		while (socket.is_open()) {
+			const auto header = parse_header({buffer.data() + position, end - position});
+			if (!header) {
+				if (!co_await read_more(message_start, message_size, position)) co_return std::nullopt;
+				continue;
+			}
+			const bool control = is_control(header->opcode);
+			// the most significant bit of a 64 bit length must be 0 (RFC 6455 5.2)
+			const bool bad_length = (header->payload_size >> 63) != 0;
+			if (header->reserved || !header->masked || !is_known(header->opcode) || bad_length || (control && (!header->fin || header->payload_size > 125))) {
+				co_await close(close_code::protocol_error);
+				co_return std::nullopt;
+			}
+			// message_size never exceeds the limit, so subtracting can't wrap where adding could
+			if (!control && header->payload_size > options.max_message_size - message_size) {
+				co_await close(close_code::too_big);
+				co_return std::nullopt;
+			}
+			if (header->payload_size > std::numeric_limits<size_t>::max() - position - header->size) {
+				co_await close(close_code::too_big);
+				co_return std::nullopt;
+			}
+			const size_t frame_end = position + header->size + static_cast<size_t>(header->payload_size);
+			if (end < frame_end) {
+				if (!co_await read_more(message_start, message_size, position)) co_return std::nullopt;
+				continue;
+			}
+			received_since_ping = true;
+			char *payload = buffer.data() + position + header->size;
+			const auto payload_size = static_cast<size_t>(header->payload_size);
+			detail::unmask({payload, payload_size}, header->mask);
+
+			if (control) {
+				if (header->opcode == Opcode::close) {
+					const auto *bytes = reinterpret_cast<const uint8_t *>(payload);
+					// echo the peer's code, unless it's one that can't be sent or the payload is malformed
+					uint16_t code = close_code::normal;
+					if (payload_size == 1)
+						code = close_code::protocol_error;
+					else if (payload_size >= 2) {
+						code = static_cast<uint16_t>(bytes[0] << 8 | bytes[1]);
+						if (!valid_close_code(code))
+							code = close_code::protocol_error;
+						else if (!valid_utf8({payload + 2, payload_size - 2}))
+							code = close_code::invalid_payload;
+					}
+					co_await close(code);
+					co_return std::nullopt;
+				}
+				if (header->opcode == Opcode::ping && !close_sent) {
+					auto owned = std::make_shared<const std::string>(payload, payload_size);
+					const detail::FrameHeader pong{Opcode::pong, owned->size()};
+					enqueue({pong.bytes, pong.size, *owned, owned});
+				}
+				// cut the control frame out, a fragmented message may continue after it
+				std::memmove(buffer.data() + position, buffer.data() + frame_end, end - frame_end);
+				end -= frame_end - position;
+				continue;
+			}
+			if (header->opcode == Opcode::continuation) {
+				if (!message_opcode) {
+					co_await close(close_code::protocol_error);
+					co_return std::nullopt;
+				}
+				std::memmove(buffer.data() + message_start + message_size, payload, payload_size);
+			} else {
+				if (message_opcode) {
+					co_await close(close_code::protocol_error);
+					co_return std::nullopt;
+				}
+				message_opcode = header->opcode;
+				message_start = position + header->size;
+			}
+			message_size += payload_size;
+			position = frame_end;
+			if (header->fin) {
+				returned = position - begin;
+				if (*message_opcode == Opcode::text && !valid_utf8({buffer.data() + message_start, message_size})) {
+					co_await close(close_code::invalid_payload);
+					co_return std::nullopt;
+				}
+				co_return Message{*message_opcode, {buffer.data() + message_start, message_size}};
+			}
+		}
+		co_return std::nullopt;
+	}
+
+	awaitable<bool> Session::send(const std::string_view payload, const Opcode opcode) {
+		if (!socket.is_open() || close_sent) co_return false;
+		const detail::FrameHeader header{opcode, payload.size()};
+		const auto position = enqueue({header.bytes, header.size, payload, nullptr});
+		while (written < position) co_await wait();
+		co_return socket.is_open();
+	}
+
+	awaitable<bool> Session::send(const Frame &frame) {
+		if (!socket.is_open() || close_sent) co_return false;
+		const auto &encoded = *frame.encoded;
+		const auto position = enqueue({encoded.header, encoded.header_size, encoded.payload, frame.encoded});
+		while (written < position) co_await wait();
+		co_return socket.is_open();
+	}
+
+	void Session::broadcast(const Frame &frame, const std::span<const std::shared_ptr<Session>> sessions) {
+		for (const auto &session : sessions) {
+			if (!session) continue;
+			// only the session's own thread touches its queue
+			asio::post(session->socket.get_executor(), [session, encoded = frame.encoded] {
+				if (session->socket.is_open() && !session->close_sent)
+					session->enqueue({encoded->header, encoded->header_size, encoded->payload, encoded});
+			});
+		}
+	}
+
+	async Session::close(const uint16_t code, const std::string_view reason) {
+		if (!close_sent && socket.is_open()) {
+			close_sent = true;
+			auto payload = std::make_shared<std::string>();
+			payload->push_back(static_cast<char>(code >> 8));
+			payload->push_back(static_cast<char>(code));
+			payload->append(reason.substr(0, 123)); // control frames carry at most 125 bytes
+			const detail::FrameHeader header{Opcode::close, payload->size()};
+			const auto position = enqueue({header.bytes, header.size, *payload, payload});
+			while (written < position) co_await wait();
+		}
+		asio::error_code ec;
+		socket.shutdown(asio::socket_base::shutdown_both, ec);
+		socket.close(ec);
+		ping_timer.cancel();
+		notify();
+	}
+} // namespace ewhttp::websocket
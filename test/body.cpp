@@ -0,0 +1,68 @@
+// Request::read_body collects bodies that arrive over several reads, with and without chunked encoding
+#include "./loopback.h"
+#include <ewhttp/ewhttp.h>
+
+#include <asio.hpp>
+#include <format>
+#include <string>
+#include <thread>
+
+namespace {
+	using ewhttp::async;
+	using ewhttp::Req;
+	using ewhttp::Res;
+	using ewhttp::test::check;
+	using ewhttp::test::exchange;
+
+	async handle(Req request, Res response) {
+		const auto body = co_await request.read_body(1024 * 1024);
+		if (!body) {
+			response.status = 413;
+			co_await response.send_body(std::string_view{"too large"});
+			co_return;
+		}
+		co_await response.send_body(*body);
+	}
+
+	// larger than a read block, and not the same letter at every block boundary
+	std::string make_body(const size_t size) {
+		std::string body(size, '\0');
+		for (size_t i = 0; i < size; i++)
+			body[i] = static_cast<char>('a' + i % 23);
+		return body;
+	}
+} // namespace
+
+int main() {
+	ewhttp::Server server{handle};
+	const auto port = ewhttp::test::free_port();
+	std::jthread runner{[&] { server.run(asio::ip::address_v4::loopback(), port); }};
+
+	{
+		const auto body = make_body(200'000);
+		const auto received = exchange(port, std::format("POST / HTTP/1.1\r\nHost: test\r\nContent-Length: {}\r\n\r\n{}", body.size(), body), [&](const std::string &received) {
+			return received.ends_with(body);
+		});
+		check(received.starts_with("HTTP/1.1 200") && received.ends_with(body), "Content-Length body over several blocks", received.substr(0, 200));
+	}
+	{
+		const auto body = make_body(50'000);
+		std::string request = "POST / HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n";
+		for (size_t at = 0; at < body.size(); at += 5'000)
+			request += std::format("{:x}\r\n{}\r\n", 5'000, body.substr(at, 5'000));
+		request += "0\r\n\r\n";
+		const auto received = exchange(port, request, [&](const std::string &received) {
+			return received.ends_with(body);
+		});
+		check(received.starts_with("HTTP/1.1 200") && received.ends_with(body), "chunked body", received.substr(0, 200));
+	}
+	{
+		const auto received = exchange(port, std::format("POST / HTTP/1.1\r\nHost: test\r\nContent-Length: {}\r\n\r\n{}", 2 * 1024 * 1024, make_body(2 * 1024 * 1024)), [](const std::string &received) {
+			return received.ends_with("too large");
+		});
+		check(received.starts_with("HTTP/1.1 413"), "body over max_size", received.substr(0, 200));
+	}
+
+	server.stop();
+	return ewhttp::test::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+// helpers for the regression tests that talk to a real server on loopback
+#pragma once
+#include <array>
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+namespace ewhttp::test {
+	using namespace std::chrono_literals;
+
+	inline uint16_t free_port() {
+		asio::io_context io_context{1};
+		asio::ip::tcp::acceptor acceptor{io_context, {asio::ip::address_v4::loopback(), 0}};
+		return acceptor.local_endpoint().port();
+	}
+
+	/**
+	 * \brief Send `requests` in one write, then read until the connection closes, `done(received)` or 5 seconds pass.
+	 * \return Everything received
+	 */
+	inline std::string exchange(const uint16_t port, const std::string_view requests, const std::function<bool(const std::string &)> &done) {
+		asio::io_context io_context{1};
+		asio::ip::tcp::socket socket{io_context};
+		for (int attempt = 0;; attempt++) {
+			asio::error_code ec;
+			socket.connect({asio::ip::address_v4::loopback(), port}, ec);
+			if (!ec) break;
+			socket.close();
+			if (attempt == 1000) throw std::system_error(ec, "connecting to the test server");
+			std::this_thread::sleep_for(1ms);
+		}
+		asio::write(socket, asio::buffer(requests.data(), requests.size()));
+		std::string received;
+		std::array<char, 4096> buffer;
+		std::function<void()> read = [&] {
+			socket.async_read_some(asio::buffer(buffer), [&](const asio::error_code ec, const size_t n) {
+				received.append(buffer.data(), n);
+				if (!ec && !done(received)) read();
+			});
+		};
+		read();
+		io_context.run_for(5s);
+		return received;
+	}
+
+	inline int failures = 0;
+	inline void check(const bool ok, const std::string_view what, const std::string &received) {
+		if (ok) return;
+		failures++;
+		std::cerr << "FAILED: " << what << "\nreceived:\n"
+				  << received << '\n';
+	}
+} // namespace ewhttp::test
@@ -5,6 +5,7 @@ int main(int argc, char **argv) {
 	std::vector<std::string_view> args(argv, argv + argc);
 	std::string_view host = "0.0.0.0";
 	int port = 80;
+	unsigned int threads = 1;
 	for (auto it = args.begin(); it != args.end(); ++it) {
 		if (*it == "-p" || *it == "--port") {
 			if (++it == args.end()) {
@@ -27,8 +28,22 @@ int main(int argc, char **argv) {
 			}
 			host = *it;
 		}
+		if (*it == "-t" || *it == "--threads") {
+			if (++it == args.end()) {
+				std::cerr << "No thread count specified after " << args.back() << std::endl;
+				return 1;
+			}
+			const auto result =
+					std::from_chars(it->data(), it->data() + it->size(), threads);
+			if (result.ec != std::errc{}) {
+				std::cerr << "Invalid number '" << *it
+						  << "': " << std::make_error_code(result.ec).message()
+						  << std::endl;
+				return 1;
+			}
+		}
 		if (*it == "--help") {
-			std::cout << "Usage: " << args[0] << " [-p|--port PORT] [-h|--host HOST]"
+			std::cout << "Usage: " << args[0] << " [-p|--port PORT] [-h|--host HOST] [-t|--threads THREADS]"
 					  << std::endl;
 			return 0;
 		}
@@ -50,10 +65,15 @@ int main(int argc, char **argv) {
 				"<li><a href=\"/ewhttp/name\">/[name]/name</a>"                   \
 				"<li><a href=\"/files/hai.txt\">/files/hai.txt</a>"               \
 				"<li><a href=\"/files/stream/hai.txt\">/files/stream/hai.txt</a>" \
+				"<li><a href=\"/metrics\">/metrics</a>"                           \
+				"<li><a href=\"/events?from=5\">/events?from=5</a>"               \
 				"</ul>"
+	static const ewhttp::HeaderBlock html_headers{{"Content-Type", "text/html"}, {"Server", "ewhttp"}};
 	const auto router = ewhttp::create_router(
+			_.rate_limit({.rate = 100, .burst = 200}),
+			_.limit(),
 			_([](Req request, Res response) {
-				response.add_header("Content-Type", "text/html");
+				response.add_headers(html_headers);
 			}),
 			_.fallback([](Req request, Res response) -> async {
 				response.status = 404;
@@ -67,11 +87,11 @@ int main(int argc, char **argv) {
 										   "\">ewhttp</a>! You visited {}" POSTFIX,
 									request.path));
 			}),
-			_("other", _("nested", GET([](Req request, Res response) -> async {
+			_("other", _("nested", GET(_.cache([](Req request, Res response) -> async {
 							 co_await response.send_body(
 									 std::format(PREFIX "You got a little deeper! You visited {}" POSTFIX,
 												 request.path));
-						 }))),
+						 }, {.ttl = 10s})))),
 			_("number",
 			  _(
 					  [](const std::string_view str, Req request,
@@ -96,11 +116,32 @@ int main(int argc, char **argv) {
 					co_await response.send_body(
 							std::format(PREFIX "Test: your name is {}" POSTFIX, part));
 				}))),
+			_("metrics", _.metrics()),
+			_("events", GET([](Req request, Res response) -> async {
+				// one event a second, counting down from ?from= (10 by default)
+				int from = 10;
+				if (const auto param = request.query_param("from"))
+					std::from_chars(param->data(), param->data() + param->size(), from);
+				auto events = response.event_stream();
+				asio::steady_timer timer{co_await asio::this_coro::executor};
+				for (int i = from; i > 0; i--) {
+					co_await events.send(std::to_string(i), "countdown");
+					co_await events.flush();
+					timer.expires_after(std::chrono::seconds{1});
+					co_await timer.async_wait(asio::use_awaitable);
+				}
+				co_await events.send("liftoff!", "done");
+				co_await events.finish();
+			})),
+			_("echo", _.websocket([](Req request, ewhttp::websocket::Session &session) -> async {
+				while (const auto message = co_await session.receive())
+					if (!co_await session.send(message->data, message->opcode)) break;
+			})),
 			_("files",
 			  _.files("./test/files", {}),
 			  _("stream", _.files("./test/files", {0}))));
 	ewhttp::Server server(router);
-	std::cout << "Listening on " << host << ":" << port << std::endl;
-	server.run(host, port);
+	std::cout << "Listening on " << host << ":" << port << " with " << threads << " thread(s)" << std::endl;
+	server.run(host, port, threads);
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+// pipelined responses go out in request order, even when a later handler finishes before an earlier one
+#include "./loopback.h"
+#include <ewhttp/ewhttp.h>
+
+#include <asio.hpp>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+	using namespace std::chrono_literals;
+	using ewhttp::async;
+	using ewhttp::Req;
+	using ewhttp::Res;
+	using ewhttp::test::check;
+	using ewhttp::test::exchange;
+
+	async handle(Req request, Res response) {
+		if (request.path == "/slow") {
+			asio::steady_timer timer{co_await asio::this_coro::executor, 100ms};
+			co_await timer.async_wait(asio::use_awaitable);
+			co_await response.send_body(std::string_view{"slow"});
+		} else if (request.path == "/fast") {
+			co_await response.send_body(std::string_view{"fast"});
+		} else {
+			throw std::runtime_error("thrown on purpose");
+		}
+	}
+} // namespace
+
+int main() {
+	ewhttp::Server server{handle};
+	const auto port = ewhttp::test::free_port();
+	std::jthread runner{[&] { server.run(asio::ip::address_v4::loopback(), port); }};
+
+	{
+		// the second handler throws right away, the first one still gets to answer before the connection is closed
+		const auto received = exchange(port, "GET /slow HTTP/1.1\r\nHost: test\r\n\r\nGET /throw HTTP/1.1\r\nHost: test\r\n\r\n", [](const std::string &) { return false; });
+		check(received.starts_with("HTTP/1.1 200") && received.ends_with("slow"), "slow response before a throwing one", received);
+	}
+	{
+		// the second handler finishes first, but writes after the first one
+		const auto received = exchange(port, "GET /slow HTTP/1.1\r\nHost: test\r\n\r\nGET /fast HTTP/1.1\r\nHost: test\r\n\r\n", [](const std::string &received) {
+			return received.ends_with("fast");
+		});
+		const auto slow = received.find("slow"), fast = received.find("fast");
+		check(slow != std::string::npos && fast != std::string::npos && slow < fast, "slow response before a fast one", received);
+	}
+
+	server.stop();
+	return ewhttp::test::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+// a WebSocket handshake over loopback gets its 101, and a frame sent right behind the request is echoed
+#include "./loopback.h"
+#include <ewhttp/ewhttp.h>
+
+#include <asio.hpp>
+#include <string>
+#include <thread>
+
+namespace {
+	using namespace ewhttp::build::underscore;
+	using ewhttp::async;
+	using ewhttp::Req;
+	using ewhttp::test::check;
+	using ewhttp::test::exchange;
+
+	// "hello" as a masked text frame, like a client has to send it
+	std::string masked_hello() {
+		constexpr std::string_view payload = "hello";
+		constexpr char mask[4] = {1, 2, 3, 4};
+		std::string frame{"\x81"};
+		frame += static_cast<char>(0x80 | payload.size());
+		frame.append(mask, 4);
+		for (size_t i = 0; i < payload.size(); i++)
+			frame += static_cast<char>(payload[i] ^ mask[i % 4]);
+		return frame;
+	}
+} // namespace
+
+int main() {
+	const auto router = ewhttp::create_router(
+			_("echo", _.websocket([](Req request, ewhttp::websocket::Session &session) -> async {
+				while (const auto message = co_await session.receive())
+					if (!co_await session.send(message->data, message->opcode)) break;
+			})));
+	ewhttp::Server server{router};
+	const auto port = ewhttp::test::free_port();
+	std::jthread runner{[&] { server.run(asio::ip::address_v4::loopback(), port); }};
+
+	{
+		// the frame is in the same write as the handshake, so it has to be handed over from the HTTP read buffer
+		const std::string request = "GET /echo HTTP/1.1\r\nHost: test\r\nConnection: Upgrade\r\nUpgrade: websocket\r\n"
+									"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n" +
+									masked_hello();
+		const std::string echoed = "\x81\x05hello";
+		const auto received = exchange(port, request, [&](const std::string &received) {
+			return received.ends_with(echoed);
+		});
+		check(received.starts_with("HTTP/1.1 101"), "101 Switching Protocols", received);
+		check(received.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != std::string::npos, "Sec-WebSocket-Accept", received);
+		check(received.ends_with(echoed), "echoed frame", received);
+	}
+	{
+		// not an upgrade, the same handler answers 400
+		const auto received = exchange(port, "GET /echo HTTP/1.1\r\nHost: test\r\n\r\n", [](const std::string &received) {
+			return received.find("\r\n\r\n") != std::string::npos;
+		});
+		check(received.starts_with("HTTP/1.1 400"), "400 without an upgrade", received);
+	}
+
+	server.stop();
+	return ewhttp::test::failures == 0 ? 0 : 1;
+}